@@ -10,8 +10,15 @@
 #define DEBUG_STATE_CACHE       (0)
 
 #define ENTROPY_2_TOP_N         (1000)
+#define N_PARTITIONS_KEPT       (16)
 #define MAX_N_SOLUTIONS_PRINTED (12)
 #define MAX_N_GUESSES_PRINTED   (10)
 #define ENTROPY_RATIO           (0.9)
+#define ENDGAME_MAX_N_SOLUTIONS (64)
+#define JOINT_SOLVE_BONUS       (1000)
+#define BENCH_MAX_N_GUESSES     (12)
+#define JOURNAL_COMPACTION_RATIO (0.25)
+#define JOURNAL_COMPACTION_MIN_SIZE (16 << 20)
 
 #define WORD_LEN                (5)
+#define N_SOLUTIONS             (2315)
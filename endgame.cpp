@@ -0,0 +1,194 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+
+#include "config.h"
+#include "endgame.h"
+#include "match.h"
+#include "matchtable.h"
+
+namespace {
+
+const uint8_t kSolved = Match::kMaxValue; // all letters correct
+const uint32_t kUnbounded = std::numeric_limits<uint32_t>::max();
+// slots of the memo before it first grows, enough for most endgames
+const std::size_t kInitialNSolved = 4096;
+
+// no guess finds any of n solutions in fewer than one guess, and only one of them in one: a
+// total of at least 2n - 1 guesses
+inline uint32_t lower_bound_of(uint32_t n) {
+    return 2 * n - 1;
+}
+
+} // namespace anonymous
+
+Endgame::SolvedTable::SolvedTable(std::size_t capacity)
+    : mSlots(capacity, Slot{ 0, Solved{ 0, false } })
+    , mShift(64 - std::countr_zero(capacity))
+    , mSize(0) {
+    assert(std::has_single_bit(capacity));
+}
+
+const Endgame::Solved *Endgame::SolvedTable::find(uint64_t mask) const {
+    const std::size_t last = mSlots.size() - 1;
+    for (std::size_t s = slot_of(mask); mSlots[s].mask != 0; s = (s + 1) & last) {
+        if (mSlots[s].mask == mask) return &mSlots[s].solved;
+    }
+    return nullptr;
+}
+
+void Endgame::SolvedTable::set(uint64_t mask, const Solved &solved) {
+    assert(mask != 0);
+    const std::size_t last = mSlots.size() - 1;
+    std::size_t s = slot_of(mask);
+    for (; mSlots[s].mask != 0; s = (s + 1) & last) {
+        if (mSlots[s].mask == mask) {
+            mSlots[s].solved = solved;
+            return;
+        }
+    }
+    mSlots[s] = Slot{ mask, solved };
+    if (++mSize * 2 > mSlots.size()) grow();
+}
+
+void Endgame::SolvedTable::grow() {
+    std::vector<Slot> slots(2 * mSlots.size(), Slot{ 0, Solved{ 0, false } });
+    slots.swap(mSlots);
+    mShift--;
+    mSize = 0;
+    for (auto &slot : slots) {
+        if (slot.mask != 0) set(slot.mask, slot.solved);
+    }
+}
+
+Endgame::Endgame(const MatchTable &match_table, const WordIds &solutions, const WordIds &guesses)
+    : mNSolutions(solutions.size())
+    , mAll((mNSolutions == kMaxNSolutions) ? ~uint64_t(0) : (uint64_t(1) << mNSolutions) - 1)
+    , mSolved(kInitialNSolved) {
+    assert(mNSolutions > 0 && mNSolutions <= kMaxNSolutions);
+
+    // one row per distinct way of splitting the solutions, dropping the guesses that don't
+    struct Row {
+        std::string matches;
+        std::size_t n_buckets;
+        bool solves;
+        WordIds guesses;
+    };
+    std::vector<Row> rows;
+    std::unordered_map<std::string, std::size_t> row_of;
+    std::string matches(mNSolutions, 0);
+    for (auto guess : guesses) {
+        bool seen[Match::kMaxValue + 1] = {};
+        std::size_t n_buckets = 0;
+        for (std::size_t i = 0; i < mNSolutions; i++) {
+            uint8_t m = match_table.at(guess, solutions[i]);
+            matches[i] = m;
+            n_buckets += !seen[m];
+            seen[m] = true;
+        }
+        if (n_buckets == 1 && !seen[kSolved]) continue;
+
+        auto it = row_of.emplace(matches, rows.size()).first;
+        if (it->second == rows.size()) {
+            rows.push_back(Row{ matches, n_buckets, seen[kSolved], WordIds() });
+        }
+        rows[it->second].guesses.push_back(guess);
+    }
+
+    // the rows likeliest to be best first, for them to bound the others early
+    std::sort(rows.begin(), rows.end(), [](const Row &lhs, const Row &rhs) {
+            return (lhs.n_buckets != rhs.n_buckets) ? lhs.n_buckets > rhs.n_buckets : lhs.solves > rhs.solves;
+        });
+    mRows.reserve(rows.size() * mNSolutions);
+    mGuesses.reserve(rows.size());
+    for (auto &row : rows) {
+        mRows.insert(mRows.end(), row.matches.begin(), row.matches.end());
+        mGuesses.push_back(std::move(row.guesses));
+    }
+}
+
+WordIds Endgame::best_guesses() {
+    const uint32_t best = solve(mAll, kUnbounded);
+
+    WordIds best_guesses;
+    for (std::size_t r = 0; r < mGuesses.size(); r++) {
+        if (solve(mAll, row(r), best + 1) == best) {
+            best_guesses.insert(best_guesses.end(), mGuesses[r].begin(), mGuesses[r].end());
+        }
+    }
+    std::sort(best_guesses.begin(), best_guesses.end());
+    return best_guesses;
+}
+
+double Endgame::expected_guesses() {
+    return static_cast<double>(solve(mAll, kUnbounded)) / mNSolutions;
+}
+
+uint32_t Endgame::solve(uint64_t mask, uint32_t limit) {
+    const uint32_t n = std::popcount(mask);
+    if (n <= 2) return lower_bound_of(n); // guessing either
+
+    const uint32_t lower_bound = lower_bound_of(n);
+    if (lower_bound >= limit) return lower_bound;
+
+    const Solved *solved = mSolved.find(mask);
+    if (solved && (solved->exact || solved->total >= limit)) {
+        return solved->total;
+    }
+
+    uint32_t best = limit;
+    bool exact = false;
+    for (std::size_t r = 0; r < mGuesses.size(); r++) {
+        uint32_t total = solve(mask, row(r), best);
+        if (total < best) {
+            best = total;
+            exact = true;
+            if (best == lower_bound) break;
+        }
+    }
+
+    mSolved.set(mask, Solved{ best, exact });
+    return best;
+}
+
+uint32_t Endgame::solve(uint64_t mask, const uint8_t *row, uint32_t limit) {
+    // bucket the solutions of mask by their match
+    uint8_t bucket_of[Match::kMaxValue + 1];
+    uint64_t buckets[kMaxNSolutions];
+    std::memset(bucket_of, 0xff, sizeof bucket_of);
+    std::size_t n_buckets = 0;
+    for (uint64_t bits = mask; bits; bits &= bits - 1) {
+        int i = std::countr_zero(bits);
+        uint8_t &b = bucket_of[row[i]];
+        if (b == 0xff) {
+            b = n_buckets;
+            buckets[n_buckets++] = 0;
+        }
+        buckets[b] |= uint64_t(1) << i;
+    }
+    const uint8_t solved = bucket_of[kSolved];
+    if (n_buckets == 1 && solved == 0xff) return kUnbounded; // no closer to the solution
+
+    // this guess, plus at least the lower bound of each bucket but the solution's
+    const uint32_t n = std::popcount(mask);
+    uint32_t total = n;
+    for (std::size_t b = 0; b < n_buckets; b++) {
+        if (b != solved) total += lower_bound_of(std::popcount(buckets[b]));
+    }
+
+    // then the buckets whose lower bound isn't exact
+    for (std::size_t b = 0; b < n_buckets && total < limit; b++) {
+        uint32_t n_b = std::popcount(buckets[b]);
+        if (b == solved || n_b <= 2) continue;
+        uint32_t lower_bound = lower_bound_of(n_b);
+        total += solve(buckets[b], limit - total + lower_bound) - lower_bound;
+    }
+    return total;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "word.h"
+
+class MatchTable;
+
+// Exact play for at most 64 solutions, which fit a uint64_t mask: the guesses minimizing the
+// expected number of guesses to find the solution, by exhaustive search memoized on the mask of
+// the solutions left. Costs are kept as the total number of guesses over all the solutions (the
+// expectation times their number), so that they are integers, and ties exact.
+class Endgame {
+public:
+    static const std::size_t kMaxNSolutions = 64;
+
+    Endgame(const MatchTable &match_table, const WordIds &solutions, const WordIds &guesses);
+
+    // all the guesses of least expected number of guesses, this one included
+    WordIds best_guesses();
+    // that expected number of guesses
+    double expected_guesses();
+
+private:
+    // the least total number of guesses for the solutions in mask if less than limit, or else a
+    // lower bound of it no less than limit
+    uint32_t solve(uint64_t mask, uint32_t limit);
+    // the same for guessing the word of row first
+    uint32_t solve(uint64_t mask, const uint8_t *row, uint32_t limit);
+    inline const uint8_t *row(std::size_t r) const { return &mRows[r * mNSolutions]; }
+
+    struct Solved {
+        uint32_t total;
+        bool exact; // or only a lower bound
+    };
+
+    // solve()'s memo, by mask, open addressed: it only allocates when it doubles, which it does a
+    // handful of times per Endgame, never per node searched
+    class SolvedTable {
+    public:
+        explicit SolvedTable(std::size_t capacity);
+
+        const Solved *find(uint64_t mask) const;
+        void set(uint64_t mask, const Solved &solved);
+
+    private:
+        struct Slot {
+            uint64_t mask; // 0 for an empty slot: no state solves no solutions
+            Solved solved;
+        };
+
+        inline std::size_t slot_of(uint64_t mask) const {
+            return (mask * 0x9e3779b97f4a7c15ull) >> mShift;
+        }
+        void grow();
+
+        std::vector<Slot> mSlots; // a power of 2 of them, at most half used
+        int mShift;
+        std::size_t mSize;
+    };
+
+    const std::size_t mNSolutions;
+    const uint64_t mAll;
+    std::vector<uint8_t> mRows;     // the matches of each distinct guess, indexed by solution index
+    std::vector<WordIds> mGuesses;  // the words of each row
+    SolvedTable mSolved;
+};
@@ -0,0 +1,323 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+
+#include "config.h"
+#include "gamestate.h"
+#include "match.h"
+#include "threadpool.h"
+
+namespace {
+
+template<typename Iter, typename RandomGenerator>
+Iter select_randomly(Iter start, Iter end, RandomGenerator& g) {
+    std::uniform_int_distribution<> dis(0, std::distance(start, end) - 1);
+    std::advance(start, dis(g));
+    return start;
+}
+
+template<typename Iter>
+Iter select_randomly(Iter start, Iter end) {
+    thread_local std::random_device rd;
+    thread_local std::mt19937 gen(rd());
+    return select_randomly(start, end, gen);
+}
+
+} // namespace anonymous
+
+void GameState::display_best_guesses(std::ostream &os) const {
+    if (state->n_solutions() == 1) {
+        os << ">>>>> THE SOLUTION: \"" << state->solutions().at(0).word() << "\" <<<<<" << std::endl;
+        return;
+    }
+
+    if (state->n_solutions() == 2) {
+        os << ">>>>> SOLUTION ONE OF: " << state->solutions().at(0) << ", " << state->solutions().at(1) << " <<<<<" << std::endl;
+        return;
+    }
+
+    auto best_guesses = state->best_guess(keyboard);
+    if (best_guesses.size() == 0) {
+        os << "No solution left 😭" << std::endl;
+        return;
+    }
+
+    if (state->n_solutions() <= MAX_N_SOLUTIONS_PRINTED) {
+        os << "Solutions and associated entropy: ";
+        bool first = true;
+        for (auto entropy : state->solution_entropies()) {
+            if (first) first = false;
+            else       os << ", ";
+            os << entropy;
+        }
+        os << std::endl;
+    }
+
+    os << "[H=" << best_guesses.front().entropy().entropy() / 1000. << "|S=" << best_guesses.front().score()
+              << "] \"" << select_randomly(best_guesses.begin(), best_guesses.end())->entropy().word().word() << "\"";
+    if (best_guesses.size() > 1) {
+        os << " (" << best_guesses.size() << " words: ";
+        bool first = true;
+        for (auto it = best_guesses.begin(); it != best_guesses.end() && distance(best_guesses.begin(), it) < MAX_N_GUESSES_PRINTED; it++) {
+            if (!first) os << ", ";
+            first = false;
+            os << "\"" << it->entropy().word().word() << "\"";
+        }
+        if (best_guesses.size() > MAX_N_GUESSES_PRINTED) {
+            os << ", ...";
+        }
+        os << ") ";
+    }
+    os << std::endl;
+}
+
+GameStates::GameStates(ThreadPool &pool, const StateCache::ptr &state_cache, const GameState &initial_game_state, std::ostream &os)
+    : mPool(pool)
+    , mStateCache(state_cache)
+    , mInitialGameState(initial_game_state)
+    , mOs(os)
+    , mBoards(kNBoards[0]) {
+   reset();
+}
+
+void GameStates::help() const {
+    mOs << "Enter your successive guesses, along with the outcome in the format:" << std::endl
+        << "    guess;cc_pp" << std::endl
+        << "  where:" << std::endl
+        << "    * \"guess\" is the word you guessed (it must be one of the allowed Wordle words), and," << std::endl
+        << "      separated by a colon (';')" << std::endl
+        << "    * a five character representation of the outcome where '_' indicates no match, 'p'" << std::endl
+        << "      indicates present and 'c' indicates correct." << std::endl;
+}
+
+void GameStates::process_line(const std::string &line) {
+    // no whitespace we care to make use of
+    std::string nowsline(line, 0);
+    nowsline.erase(std::remove_if(nowsline.begin(), nowsline.end(), [](auto c){ return std::isspace(c); }), nowsline.end());
+    if (nowsline.size() == 0) { return; }
+
+    switch(nowsline[0]) {
+        case '#': // it's a comment
+            mOs << line << std::endl;
+            return;
+
+        case '!': // reset!
+            mOs << "# RESET!" << std::endl;
+            reset();
+            return;
+
+        case '^': // back one
+            mOs << "^ BACK ONE" << std::endl;
+            back_one();
+            return;
+
+        case '%': { // change number of concurrent games, to the next usual one or to the one given
+            long n_boards = next_game();
+            if (nowsline.size() > 1) {
+                char *end;
+                errno = 0;
+                n_boards = std::strtol(nowsline.c_str() + 1, &end, 10);
+                if (errno != 0 || *end != '\0') n_boards = 0;
+            }
+            if (n_boards < 1 || n_boards > kMaxNBoards) {
+                help();
+                return;
+            }
+            mOs << "% SWITCHING TO " << n_boards << " CONCURRENT GAMES" << std::endl;
+            switch_game(n_boards);
+            }
+            return;
+
+        case '*': // persist!
+            mOs << "* PERSISTING CACHE" << std::endl;
+            mStateCache->persist();
+            return;
+
+        case '?': { // what is the entropy of the word?
+            std::string word = nowsline.substr(1);
+            for (auto i = 0; i < current_game(); i++) {
+                mOs << "[" << i << "] H(\"" << word << "\") = "
+                    << at(i).state->entropy_of(word) / 1000. << std::endl;
+                mOs << "[" << i << "]H2(\"" << word << "\") = "
+                    << at(i).state->entropy2_of(word) / 1000. << std::endl;
+            }
+            }
+            return;
+
+        default:
+            break;
+    }
+
+    auto ofs = nowsline.find(';');
+    std::string guess = nowsline.substr(0, ofs);
+
+    std::vector<std::string> matches;
+    while (ofs != std::string::npos) {
+        auto ofs2 = nowsline.find(';', ofs + 1);
+        std::string match = nowsline.substr(ofs + 1, ofs2 - ofs - 1) ;
+        matches.push_back(match);
+        ofs = ofs2;
+    }
+    process_guess(guess, matches);
+#if DEBUG_STATE_CACHE
+    mOs << mStateCache->report() << std::endl;
+#endif // DEBUG_STATE_CACHE
+}
+
+void GameStates::reset() {
+    for (auto &board : mBoards) {
+        board.clear();
+        board.push_back(mInitialGameState);
+    }
+    mInitialGameState.serialize(mOs);
+}
+
+void GameStates::back_one() {
+   if (!undo()) {
+       mOs << "Already at initial state" << std::endl;
+       return;
+   }
+
+   for (auto &board : mBoards) {
+       board.back().serialize(mOs);
+       if (board.size() != 1) { // not back at initial game state
+          board.back().display_best_guesses(mOs);
+       }
+   }
+   if (mBoards[0].size() != 1) {
+       display_joint_best_guesses();
+   }
+}
+
+bool GameStates::undo() {
+   if (mBoards[0].size() == 1) return false;
+
+   for (auto &board : mBoards) {
+       board.pop_back();
+   }
+   return true;
+}
+
+void GameStates::switch_game(int n_boards) {
+   mBoards = std::vector<std::vector<GameState>>(n_boards);
+   reset();
+}
+
+int GameStates::next_game() const {
+    auto it = std::upper_bound(std::begin(kNBoards), std::end(kNBoards), current_game());
+    return (it == std::end(kNBoards)) ? kNBoards[0] : *it;
+}
+
+void GameStates::process_guess(const std::string &guess, const std::vector<std::string> &matches) {
+    if (matches.size() != mBoards.size()) {
+        help();
+        return;
+    }
+
+    std::vector<bool> was_solved(mBoards.size());
+    for (std::size_t i = 0; i < mBoards.size(); i++) {
+        was_solved[i] = mBoards[i].back().state->n_solutions() == 1;
+    }
+    auto applied = apply_guess(guess, matches);
+
+    // then each board, displayed in order once they all are
+    std::vector<std::ostringstream> outputs(mBoards.size());
+    bool invalid = false;
+    for (std::size_t i = 0; i < mBoards.size(); i++) {
+        if (applied[i]) {
+            outputs[i] << "Considering guess \"" << guess << "\" with match " << applied[i]->toString() << std::endl;
+            mBoards[i].back().serialize(outputs[i]);
+        }
+        else if (!was_solved[i]) {
+            invalid = true;
+        }
+    }
+    if (invalid) {
+        help(); // once for the line, however many boards it failed on
+    }
+    mPool.parallel_for(0, mBoards.size(), 1, [this, &applied, &outputs](std::size_t i) {
+            if (applied[i] || mBoards[i].back().state->n_solutions() == 1) {
+                mBoards[i].back().display_best_guesses(outputs[i]);
+            }
+        });
+    for (auto &output : outputs) {
+        mOs << output.str();
+    }
+    display_joint_best_guesses();
+}
+
+std::vector<std::optional<Match>> GameStates::apply_guess(const std::string &guess, const std::vector<std::string> &matches) {
+    std::vector<std::optional<Match>> applied(mBoards.size());
+    if (matches.size() != mBoards.size()) return applied;
+
+    // the boards still being solved, and their match; boards at the same state with the same
+    // match lead to the same state, which is only considered once
+    struct Update {
+        State::ptr state;
+        uint32_t match;
+        State::ptr next;
+    };
+    std::vector<Update> updates;
+    std::vector<std::size_t> update_of(mBoards.size());
+    for (std::size_t i = 0; i < mBoards.size(); i++) {
+        auto &gs = mBoards[i].back();
+        if (gs.state->n_solutions() == 1) continue;
+        if (guess.size() != matches[i].size()) continue;
+
+        bool ok = true;
+        Match m = Match::fromString(guess, matches[i], ok);
+        if (!ok) continue;
+
+        auto it = std::find_if(updates.begin(), updates.end(), [&gs, &m](const Update &u) { return u.state == gs.state && u.match == m.value(); });
+        if (it == updates.end()) {
+            it = updates.insert(updates.end(), Update{ gs.state, m.value(), nullptr });
+        }
+        update_of[i] = it - updates.begin();
+        applied[i].emplace(m);
+    }
+
+    mPool.parallel_for(0, updates.size(), 1, [&guess, &updates](std::size_t u) {
+            updates[u].next = updates[u].state->consider_guess(guess, updates[u].match);
+        });
+
+    for (std::size_t i = 0; i < mBoards.size(); i++) {
+        auto &gs = mBoards[i].back();
+        if (gs.state->n_solutions() == 1) {
+            mBoards[i].push_back(GameState(gs.generation, gs.state, gs.keyboard, gs.words, gs.solved || guess == gs.state->solutions().at(0).word()));
+        }
+        else if (applied[i]) {
+            const Match &m = *applied[i];
+            auto k = gs.keyboard.update_with_guess(guess, m);
+            ConsistentWords::ptr w(new ConsistentWords(gs.words, guess, m.value()));
+            mBoards[i].push_back(GameState(gs.generation + 1, updates[update_of[i]].next, k, w, m.value() == Match::kMaxValue));
+        }
+    }
+    return applied;
+}
+
+std::vector<ScoredEntropy> GameStates::joint_best_guesses() const {
+    std::vector<State::ptr> states;
+    std::vector<Keyboard> keyboards;
+    for (auto &board : mBoards) {
+        auto &gs = board.back();
+        if (gs.solved) continue;
+        states.push_back(gs.state);
+        keyboards.push_back(gs.keyboard);
+    }
+    if (states.size() < 2) return std::vector<ScoredEntropy>();
+
+    return State::joint_best_guess(states, keyboards);
+}
+
+void GameStates::display_joint_best_guesses() const {
+    auto best_guesses = joint_best_guesses();
+    if (best_guesses.empty()) return;
+
+    std::size_t n_unsolved = std::count_if(mBoards.begin(), mBoards.end(), [](const std::vector<GameState> &board) { return !board.back().solved; });
+    mOs << "[ALL " << n_unsolved << "] [H=" << best_guesses.front().entropy().entropy() / 1000. << "|S=" << best_guesses.front().score()
+        << "] \"" << select_randomly(best_guesses.begin(), best_guesses.end())->entropy().word().word() << "\"" << std::endl;
+}
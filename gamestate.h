@@ -0,0 +1,122 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "keyboard.h"
+#include "match.h"
+#include "state.h"
+#include "statecache.h"
+#include "wordlist.h"
+
+class ThreadPool;
+
+// The allowed words still consistent with every guess so far. A State only knows its remaining
+// solutions (it is shared by every path that leads to them), so these are tracked per game. They
+// are only ever displayed, so they are only filtered, from the previous generation's, when asked for.
+class ConsistentWords {
+public:
+    typedef std::shared_ptr<ConsistentWords> ptr;
+
+    ConsistentWords(const Wordlist &word_list)
+        : mWordList(word_list)
+        , mMatch(0)
+        , mWords(word_list.all_word_ids()) { }
+
+    ConsistentWords(const ptr &previous, const std::string &guess, uint32_t match)
+        : mWordList(previous->mWordList)
+        , mPrevious(previous)
+        , mGuess(guess)
+        , mMatch(match) { }
+
+    const WordIds &words() {
+        if (!mWords) {
+            mWords = mWordList.filtered_words_for_guess(mPrevious->words(), mGuess, mMatch);
+            mPrevious.reset();
+        }
+        return *mWords;
+    }
+
+private:
+    const Wordlist &mWordList;
+    ptr mPrevious;
+    std::string mGuess;
+    uint32_t mMatch;
+    std::optional<WordIds> mWords;
+};
+
+struct GameState {
+    GameState(int g, const State::ptr &s, const Keyboard &k, const ConsistentWords::ptr &w, bool solved = false)
+        : generation(g)
+        , state(s)
+        , keyboard(k)
+        , words(w)
+        , solved(solved) { }
+
+    inline void serialize(std::ostream &os) const {
+        os << "State[gen:" << generation << "]: S:" << state->n_solutions() << "|W:" << words->words().size() << std::endl;
+        if (generation == 1) {
+            os << "Initial best guess is \"trace\"." << std::endl;
+        }
+    }
+
+    void display_best_guesses(std::ostream &os) const;
+
+    const int generation;
+    const State::ptr state;
+    const Keyboard keyboard;
+    const ConsistentWords::ptr words;
+    const bool solved; // its solution was guessed
+};
+
+// One player's games, on as many boards as they play at once, driven by the lines they enter and
+// reporting to their own stream: several can share the pool and the state cache.
+class GameStates {
+public:
+    // Wordle, Quordle, Octordle, Sedecordle, Duotrigordle
+    static constexpr int kNBoards[] = { 1, 4, 8, 16, 32 };
+    static constexpr int kMaxNBoards = 32;
+
+    GameStates(ThreadPool &pool, const StateCache::ptr &state_cache, const GameState &initial_game_state, std::ostream &os);
+
+    // a guess and its matches, or a command
+    void process_line(const std::string &line);
+
+    void reset();
+    void back_one();
+    void switch_game(int n_boards);
+
+    int current_game() const { return mBoards.size(); }
+    int next_game() const;
+
+    GameState &at(std::size_t i) {
+        return mBoards[i % mBoards.size()].back();
+    }
+
+    void process_guess(const std::string &guess, const std::vector<std::string> &matches);
+    // the one guess to play on all the boards still unsolved, when there are several
+    void display_joint_best_guesses() const;
+
+    // the same, without displaying anything: the match of guess on each board it was applied to,
+    // none on those already solved or whose match isn't valid
+    std::vector<std::optional<Match>> apply_guess(const std::string &guess, const std::vector<std::string> &matches);
+    // back one generation; false if already at the initial state
+    bool undo();
+    // empty unless at least two boards are still unsolved
+    std::vector<ScoredEntropy> joint_best_guesses() const;
+
+private:
+    void help() const;
+
+    ThreadPool &mPool;
+    const StateCache::ptr mStateCache;
+    const GameState &mInitialGameState;
+    std::ostream &mOs;
+
+    std::vector<std::vector<GameState>> mBoards; // the game states of each board, latest last
+};
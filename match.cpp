@@ -3,6 +3,10 @@
 #include <cassert>
 #include <iostream>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "config.h"
 #include "match.h"
 
@@ -14,6 +18,156 @@ std::string kMatchValueString[] = {
     "🟩"
 };
 
+const uint32_t kPow3[WORD_LEN] = { 1, 3, 9, 27, 81 };
+
+// The packed kernels compute the outcome of Match::Match() without its two passes: guess letter
+// i is correct if it matches solution letter i; otherwise it is present if the solution has more
+// non-correct occurrences of the letter than there are non-correct occurrences of it earlier in
+// the guess (those consume the solution's occurrences first).
+struct PackedGuess {
+    PackedGuess(uint32_t guess) {
+        for (size_t i = 0; i < WORD_LEN; i++) {
+            letter[i] = Match::letter_at(guess, i);
+            n_earlier[i] = 0;
+            for (size_t j = 0; j < i; j++) {
+                if (Match::letter_at(guess, j) == letter[i]) earlier[i][n_earlier[i]++] = j;
+            }
+        }
+    }
+
+    uint32_t letter[WORD_LEN];
+    size_t earlier[WORD_LEN][WORD_LEN] = {};
+    size_t n_earlier[WORD_LEN];
+};
+
+inline uint32_t packed_value_of(const PackedGuess &g, uint32_t solution) {
+    uint32_t letter[WORD_LEN];
+    bool correct[WORD_LEN];
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        letter[i] = Match::letter_at(solution, i);
+        correct[i] = letter[i] == g.letter[i];
+    }
+
+    uint32_t value = 0;
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        if (correct[i]) {
+            value += Match::kCorrect * kPow3[i];
+            continue;
+        }
+        uint32_t available = 0;
+        for (size_t k = 0; k < WORD_LEN; k++) {
+            available += !correct[k] && letter[k] == g.letter[i];
+        }
+        uint32_t used = 0;
+        for (size_t j = 0; j < g.n_earlier[i]; j++) {
+            used += !correct[g.earlier[i][j]];
+        }
+        if (available > used) value += Match::kPresent * kPow3[i];
+    }
+    return value;
+}
+
+// the widest kernel the CPU has: AVX2, picked at run time unless the target already has it, SSE2
+// (x86-64 always has it), or one solution at a time
+#if defined(__AVX2__)
+#define AVX2_TARGET
+#define HAS_AVX2_KERNEL (1)
+#elif defined(__SSE2__) && defined(__GNUC__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define HAS_AVX2_KERNEL (1)
+#else
+#define HAS_AVX2_KERNEL (0)
+#endif
+
+#if HAS_AVX2_KERNEL
+const size_t kAvx2Lanes = 8;
+
+AVX2_TARGET inline void packed_values_of_avx2(const PackedGuess &g, const uint32_t *solutions, uint8_t *values) {
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(solutions));
+    const __m256i mask = _mm256_set1_epi32(0x1f);
+
+    __m256i letter[WORD_LEN], correct[WORD_LEN], guess[WORD_LEN];
+    __m256i value = _mm256_setzero_si256();
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        letter[i] = _mm256_and_si256(_mm256_srli_epi32(s, 5 * i), mask);
+        guess[i] = _mm256_set1_epi32(g.letter[i]);
+        correct[i] = _mm256_cmpeq_epi32(letter[i], guess[i]);
+        value = _mm256_add_epi32(value, _mm256_and_si256(correct[i], _mm256_set1_epi32(Match::kCorrect * kPow3[i])));
+    }
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        // comparison results are all ones (-1) when true, so subtracting them counts
+        __m256i available = _mm256_setzero_si256();
+        for (size_t k = 0; k < WORD_LEN; k++) {
+            available = _mm256_sub_epi32(available, _mm256_andnot_si256(correct[k], _mm256_cmpeq_epi32(letter[k], guess[i])));
+        }
+        __m256i used = _mm256_setzero_si256();
+        for (size_t j = 0; j < g.n_earlier[i]; j++) {
+            used = _mm256_sub_epi32(used, _mm256_andnot_si256(correct[g.earlier[i][j]], _mm256_set1_epi32(-1)));
+        }
+        __m256i present = _mm256_andnot_si256(correct[i], _mm256_cmpgt_epi32(available, used));
+        value = _mm256_add_epi32(value, _mm256_and_si256(present, _mm256_set1_epi32(Match::kPresent * kPow3[i])));
+    }
+
+    alignas(32) uint32_t out[kAvx2Lanes];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(out), value);
+    for (size_t l = 0; l < kAvx2Lanes; l++) values[l] = out[l];
+}
+
+AVX2_TARGET void packed_values_avx2(const PackedGuess &g, const uint32_t *solutions, size_t n, uint8_t *values) {
+    size_t i = 0;
+    for (; i + kAvx2Lanes <= n; i += kAvx2Lanes) {
+        packed_values_of_avx2(g, solutions + i, values + i);
+    }
+    for (; i < n; i++) {
+        values[i] = packed_value_of(g, solutions[i]);
+    }
+}
+
+bool has_avx2() {
+#if defined(__AVX2__)
+    return true;
+#else
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+#endif
+}
+#endif // HAS_AVX2_KERNEL
+
+#if defined(__SSE2__)
+const size_t kSse2Lanes = 4;
+
+inline void packed_values_of_sse2(const PackedGuess &g, const uint32_t *solutions, uint8_t *values) {
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(solutions));
+    const __m128i mask = _mm_set1_epi32(0x1f);
+
+    __m128i letter[WORD_LEN], correct[WORD_LEN], guess[WORD_LEN];
+    __m128i value = _mm_setzero_si128();
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        letter[i] = _mm_and_si128(_mm_srli_epi32(s, 5 * i), mask);
+        guess[i] = _mm_set1_epi32(g.letter[i]);
+        correct[i] = _mm_cmpeq_epi32(letter[i], guess[i]);
+        value = _mm_add_epi32(value, _mm_and_si128(correct[i], _mm_set1_epi32(Match::kCorrect * kPow3[i])));
+    }
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        // comparison results are all ones (-1) when true, so subtracting them counts
+        __m128i available = _mm_setzero_si128();
+        for (size_t k = 0; k < WORD_LEN; k++) {
+            available = _mm_sub_epi32(available, _mm_andnot_si128(correct[k], _mm_cmpeq_epi32(letter[k], guess[i])));
+        }
+        __m128i used = _mm_setzero_si128();
+        for (size_t j = 0; j < g.n_earlier[i]; j++) {
+            used = _mm_sub_epi32(used, _mm_andnot_si128(correct[g.earlier[i][j]], _mm_set1_epi32(-1)));
+        }
+        __m128i present = _mm_andnot_si128(correct[i], _mm_cmpgt_epi32(available, used));
+        value = _mm_add_epi32(value, _mm_and_si128(present, _mm_set1_epi32(Match::kPresent * kPow3[i])));
+    }
+
+    alignas(16) uint32_t out[kSse2Lanes];
+    _mm_store_si128(reinterpret_cast<__m128i *>(out), value);
+    for (size_t l = 0; l < kSse2Lanes; l++) values[l] = out[l];
+}
+#endif // __SSE2__
+
 } // namespace anonymous
 
 Match::Match(const std::string &guess, const std::string &solution) {
@@ -162,3 +316,66 @@ uint32_t Match::value() const {
     }
     return value;
 }
+
+uint32_t Match::pack(const std::string &word) {
+    assert(word.size() == WORD_LEN);
+
+    uint32_t packed = 0;
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        assert(word[i] >= 'a' && word[i] <= 'z');
+        packed |= static_cast<uint32_t>(word[i] - 'a') << (5 * i);
+    }
+    return packed;
+}
+
+uint32_t Match::packed_value(uint32_t guess, uint32_t solution) {
+    return packed_value_of(PackedGuess(guess), solution);
+}
+
+void Match::packed_values(uint32_t guess, const uint32_t *solutions, size_t n, uint8_t *values) {
+    packed_values(packed_kernel(), guess, solutions, n, values);
+}
+
+Match::PackedKernel Match::packed_kernel() {
+#if HAS_AVX2_KERNEL
+    if (has_avx2()) return kAvx2Kernel;
+#endif
+#if defined(__SSE2__)
+    return kSse2Kernel;
+#else
+    return kScalarKernel;
+#endif
+}
+
+bool Match::has_packed_kernel(PackedKernel kernel) {
+    return kernel <= packed_kernel();
+}
+
+const char *Match::packed_kernel_name(PackedKernel kernel) {
+    static const char *kNames[kNPackedKernels] = { "scalar", "sse2", "avx2" };
+    return kNames[kernel];
+}
+
+void Match::packed_values(PackedKernel kernel, uint32_t guess, const uint32_t *solutions, size_t n, uint8_t *values) {
+    assert(has_packed_kernel(kernel));
+    const PackedGuess g(guess);
+
+#if HAS_AVX2_KERNEL
+    if (kernel == kAvx2Kernel) {
+        packed_values_avx2(g, solutions, n, values);
+        return;
+    }
+#endif
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (kernel == kSse2Kernel) {
+        for (; i + kSse2Lanes <= n; i += kSse2Lanes) {
+            packed_values_of_sse2(g, solutions + i, values + i);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        values[i] = packed_value_of(g, solutions[i]);
+    }
+}
@@ -20,6 +20,24 @@ public:
 
     static Match fromString(const std::string &guess, const std::string match_string, bool &ok);
 
+    // words packed as 5 bits per letter, letter i in bits [5i, 5i+5)
+    static uint32_t pack(const std::string &word);
+    static inline uint32_t letter_at(uint32_t packed, size_t i) { return (packed >> (5 * i)) & 0x1f; }
+
+    // same as Match(guess, solution).value(), on packed words
+    static uint32_t packed_value(uint32_t guess, uint32_t solution);
+    // packed_value() of guess against each of n solutions, vectorized as wide as the CPU allows
+    static void packed_values(uint32_t guess, const uint32_t *solutions, size_t n, uint8_t *values);
+
+    // the kernels of packed_values(), narrowest first
+    enum PackedKernel { kScalarKernel, kSse2Kernel, kAvx2Kernel, kNPackedKernels };
+    // the one packed_values() uses: the widest the CPU has
+    static PackedKernel packed_kernel();
+    static bool has_packed_kernel(PackedKernel kernel);
+    static const char *packed_kernel_name(PackedKernel kernel);
+    // packed_values() with kernel, which the CPU must have
+    static void packed_values(PackedKernel kernel, uint32_t guess, const uint32_t *solutions, size_t n, uint8_t *values);
+
     std::string toString() const;
     uint32_t value() const;
 
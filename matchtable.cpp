@@ -0,0 +1,116 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+
+#include "config.h"
+#include "match.h"
+#include "matchtable.h"
+#include "threadpool.h"
+#include "wordlist.h"
+
+namespace {
+
+const char *kMatchTableFileName = "wordle_match_table.bin";
+
+} // namespace anonymous
+
+MatchTable::MatchTable(ThreadPool &pool, const Wordlist &word_list, std::ostream &log)
+    : mWordList(word_list)
+    , mNGuesses(word_list.all_words().size())
+    , mNSolutions(word_list.n_solutions())
+    , mSignature(word_list.signature())
+    , mTable(mNGuesses * mNSolutions)
+    , mMasks(new std::atomic<const GuessMasks *>[mNGuesses]) {
+
+    assert(mNSolutions <= N_SOLUTIONS);
+    for (std::size_t g = 0; g < mNGuesses; g++) mMasks[g] = nullptr;
+
+    log << "Loading match table..." << std::flush;
+    if (restore()) {
+        log << " done" << std::endl;
+        return;
+    }
+    log << " failed: computing" << std::flush;
+
+    build(pool);
+    persist();
+    log << " done" << std::endl;
+}
+
+MatchTable::~MatchTable() {
+    for (std::size_t g = 0; g < mNGuesses; g++) delete mMasks[g].load();
+}
+
+const SolutionSet &MatchTable::mask(uint16_t guess, uint32_t match) const {
+    static const SolutionSet kNoSolutions;
+
+    const GuessMasks *masks = mMasks[guess].load(std::memory_order_acquire);
+    if (!masks) {
+        const GuessMasks *built = build_masks(guess);
+        if (mMasks[guess].compare_exchange_strong(masks, built, std::memory_order_acq_rel)) {
+            masks = built;
+        }
+        else { // built concurrently; masks now holds the winner's
+            delete built;
+        }
+    }
+
+    uint8_t i = masks->index[match];
+    return i == GuessMasks::kEmpty ? kNoSolutions : masks->masks[i];
+}
+
+const MatchTable::GuessMasks *MatchTable::build_masks(uint16_t guess) const {
+    GuessMasks *masks = new GuessMasks;
+    std::fill(std::begin(masks->index), std::end(masks->index), GuessMasks::kEmpty);
+
+    const uint8_t *matches = row(guess);
+    for (std::size_t s = 0; s < mNSolutions; s++) {
+        uint8_t &i = masks->index[matches[s]];
+        if (i == GuessMasks::kEmpty) {
+            i = masks->masks.size();
+            masks->masks.push_back(SolutionSet());
+        }
+        masks->masks[i].set(s);
+    }
+    return masks;
+}
+
+void MatchTable::build(ThreadPool &pool) {
+    const std::vector<uint32_t> &packed_words = mWordList.packed_words();
+
+    pool.parallel_for(0, mNGuesses, 64, [this, &packed_words](std::size_t g) {
+            Match::packed_values(packed_words[g], packed_words.data(), mNSolutions, &mTable[g * mNSolutions]);
+        });
+}
+
+bool MatchTable::restore() {
+    std::ifstream ifs;
+    ifs.open(kMatchTableFileName, std::ifstream::binary);
+    if (ifs.fail()) return false;
+
+    uint64_t signature = 0;
+    uint32_t n_guesses = 0, n_solutions = 0;
+    ifs.read(reinterpret_cast<char *>(&signature), sizeof signature);
+    ifs.read(reinterpret_cast<char *>(&n_guesses), sizeof n_guesses);
+    ifs.read(reinterpret_cast<char *>(&n_solutions), sizeof n_solutions);
+    if (!ifs || signature != mSignature || n_guesses != mNGuesses || n_solutions != mNSolutions) return false;
+
+    ifs.read(reinterpret_cast<char *>(mTable.data()), mTable.size());
+    return ifs.gcount() == static_cast<std::streamsize>(mTable.size());
+}
+
+void MatchTable::persist() const {
+    std::ofstream ofs;
+    ofs.open(kMatchTableFileName, std::ofstream::trunc|std::ofstream::binary);
+
+    uint32_t n_guesses = mNGuesses, n_solutions = mNSolutions;
+    ofs.write(reinterpret_cast<const char *>(&mSignature), sizeof mSignature);
+    ofs.write(reinterpret_cast<const char *>(&n_guesses), sizeof n_guesses);
+    ofs.write(reinterpret_cast<const char *>(&n_solutions), sizeof n_solutions);
+    ofs.write(reinterpret_cast<const char *>(mTable.data()), mTable.size());
+
+    ofs.close();
+}
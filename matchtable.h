@@ -0,0 +1,58 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "match.h"
+#include "solutionset.h"
+
+class ThreadPool;
+class Wordlist;
+
+// Precomputed Match::value() for every (guess, solution) pair of the word list, indexed by
+// word ids. Built once at startup (or loaded from disk) so that the hot loops in State only
+// ever do a byte load instead of a Match computation.
+class MatchTable {
+public:
+    // progress (loading, building) is reported to log
+    MatchTable(ThreadPool &pool, const Wordlist &word_list, std::ostream &log = std::cout);
+    ~MatchTable();
+
+    inline uint8_t at(uint16_t guess, uint16_t solution) const {
+        return mTable[static_cast<std::size_t>(guess) * mNSolutions + solution];
+    }
+
+    inline const uint8_t *row(uint16_t guess) const {
+        return &mTable[static_cast<std::size_t>(guess) * mNSolutions];
+    }
+
+    inline std::size_t n_guesses() const { return mNGuesses; }
+    inline std::size_t n_solutions() const { return mNSolutions; }
+
+    // the solutions for which guess yields match; built for all matches of a guess on first use
+    const SolutionSet &mask(uint16_t guess, uint32_t match) const;
+
+private:
+    struct GuessMasks {
+        static const uint8_t kEmpty = 0xff;
+        uint8_t index[Match::kMaxValue + 1]; // into masks, or kEmpty
+        std::vector<SolutionSet> masks;
+    };
+
+    void build(ThreadPool &pool);
+    bool restore();
+    void persist() const;
+    const GuessMasks *build_masks(uint16_t guess) const;
+
+    const Wordlist &mWordList;
+    const std::size_t mNGuesses;
+    const std::size_t mNSolutions;
+    const uint64_t mSignature;
+    std::vector<uint8_t> mTable;
+    const std::unique_ptr<std::atomic<const GuessMasks *>[]> mMasks;
+};
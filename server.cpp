@@ -0,0 +1,196 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <streambuf>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gamestate.h"
+#include "server.h"
+#include "threadpool.h"
+
+namespace {
+
+// how often the accepting loop checks for a signal
+const int kPollTimeoutMs = 250;
+const std::size_t kReadSize = 4096;
+
+volatile std::sig_atomic_t gStop = 0;
+
+void stop(int) {
+    gStop = 1;
+}
+
+// Output to a socket, sent whenever flushed, as std::endl does. Whatever the peer doesn't take
+// anymore is dropped: the session ends with its next read.
+class SocketBuf : public std::streambuf {
+public:
+    explicit SocketBuf(int fd) : mFd(fd) { }
+    ~SocketBuf() { sync(); }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) mPending.push_back(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        mPending.append(s, n);
+        return n;
+    }
+
+    int sync() override {
+        std::size_t sent = 0;
+        while (sent < mPending.size()) {
+            ssize_t n = ::send(mFd, mPending.data() + sent, mPending.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            sent += n;
+        }
+        mPending.clear();
+        return 0;
+    }
+
+private:
+    const int mFd;
+    std::string mPending;
+};
+
+// the next line read from fd, without its end of line; false once the peer is gone
+bool read_line(int fd, std::string &pending, std::string &line) {
+    std::size_t eol;
+    while ((eol = pending.find('\n')) == std::string::npos) {
+        char chunk[kReadSize];
+        ssize_t n = ::read(fd, chunk, sizeof chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        pending.append(chunk, n);
+    }
+    line.assign(pending, 0, eol);
+    pending.erase(0, eol + 1);
+    return true;
+}
+
+} // namespace anonymous
+
+Server::Server(ThreadPool &pool, const StateCache::ptr &state_cache, const GameState &initial_game_state)
+    : mPool(pool)
+    , mStateCache(state_cache)
+    , mInitialGameState(initial_game_state) { }
+
+Server::~Server() {
+    for (auto &session : mSessions) {
+        if (session.thread.joinable()) session.thread.join();
+    }
+}
+
+bool Server::serve(const std::string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        std::cout << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cout << "Failed to create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    ::unlink(addr.sun_path); // left over by a previous daemon
+    if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 || ::listen(listen_fd, SOMAXCONN) < 0) {
+        std::cout << "Failed to listen on " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(listen_fd);
+        return false;
+    }
+
+    gStop = 0;
+    auto previous_int = std::signal(SIGINT, stop);
+    auto previous_term = std::signal(SIGTERM, stop);
+    std::cout << "Listening on " << path << std::endl;
+
+    while (!gStop) {
+        pollfd pfd = { listen_fd, POLLIN, 0 };
+        int ready = ::poll(&pfd, 1, kPollTimeoutMs);
+        join_done_sessions();
+        if (ready <= 0) continue;
+
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        std::lock_guard<std::mutex> lock(mSessionsLock);
+        Session &session = mSessions.emplace_back();
+        session.fd = fd;
+        session.done = false;
+        session.thread = std::thread([this, &session]() { run(session); });
+    }
+
+    ::close(listen_fd);
+    ::unlink(addr.sun_path);
+    std::signal(SIGINT, previous_int);
+    std::signal(SIGTERM, previous_term);
+
+    // each session ends once done with the lines it has read, their output sent
+    {
+        std::lock_guard<std::mutex> lock(mSessionsLock);
+        for (auto &session : mSessions) {
+            if (session.fd >= 0) ::shutdown(session.fd, SHUT_RD);
+        }
+    }
+    for (auto &session : mSessions) {
+        session.thread.join();
+    }
+    mSessions.clear();
+    std::cout << "Stopped listening on " << path << std::endl;
+    return true;
+}
+
+void Server::run(Session &session) {
+    {
+        SocketBuf buf(session.fd);
+        std::ostream os(&buf);
+        // a line that fails ends its session only, not the daemon and the others
+        try {
+            GameStates game_states(mPool, mStateCache, mInitialGameState, os);
+            std::string pending, line;
+            for (;;) {
+                os << "] " << std::flush;
+                if (!read_line(session.fd, pending, line)) break;
+                game_states.process_line(line);
+            }
+        }
+        catch (const std::exception &e) {
+            os << "Session ended: " << e.what() << std::endl;
+        }
+        catch (...) {
+            os << "Session ended" << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mSessionsLock);
+    ::close(session.fd);
+    session.fd = -1;
+    session.done = true;
+}
+
+void Server::join_done_sessions() {
+    for (auto it = mSessions.begin(); it != mSessions.end(); ) {
+        if (it->done) {
+            it->thread.join();
+            std::lock_guard<std::mutex> lock(mSessionsLock);
+            it = mSessions.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+}
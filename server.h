@@ -0,0 +1,44 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "statecache.h"
+
+struct GameState;
+class ThreadPool;
+
+// Many players at once, each connected over a Unix domain socket and playing their own games with
+// the same line protocol as the interactive solver. Every session gets a thread to wait on its
+// socket, while all of them share the pool to compute on and the state cache, loaded only once.
+class Server {
+public:
+    Server(ThreadPool &pool, const StateCache::ptr &state_cache, const GameState &initial_game_state);
+    ~Server();
+
+    // accepts sessions on a socket at path until SIGINT or SIGTERM, then waits for them to be
+    // done with the lines they have read; false if it couldn't listen
+    bool serve(const std::string &path);
+
+private:
+    struct Session {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> done;
+    };
+
+    void run(Session &session);
+    void join_done_sessions();
+
+    ThreadPool &mPool;
+    const StateCache::ptr mStateCache;
+    const GameState &mInitialGameState;
+
+    std::list<Session> mSessions;
+    std::mutex mSessionsLock; // for their fds, closed by their own thread
+};
@@ -0,0 +1,85 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// A set of solutions as a fixed-size bitset over solution ids (which are also word ids, since
+// solutions come first in Wordlist::all_words()).
+class SolutionSet {
+public:
+    static const std::size_t kNWords = (N_SOLUTIONS + 63) / 64;
+
+    inline SolutionSet()
+        : mBits{} { }
+
+    // from kNWords words of raw bits, as returned by data()
+    explicit inline SolutionSet(const uint64_t *bits) {
+        std::copy(bits, bits + kNWords, mBits.begin());
+    }
+
+    static inline SolutionSet first(std::size_t n) {
+        SolutionSet s;
+        for (std::size_t id = 0; id < n; id++) s.set(id);
+        return s;
+    }
+
+    inline void set(uint16_t id) {
+        mBits[id / 64] |= uint64_t(1) << (id % 64);
+    }
+
+    inline bool test(uint16_t id) const {
+        return mBits[id / 64] & (uint64_t(1) << (id % 64));
+    }
+
+    inline std::size_t count() const {
+        std::size_t n = 0;
+        for (auto w : mBits) n += std::popcount(w);
+        return n;
+    }
+
+    inline bool empty() const {
+        for (auto w : mBits) if (w) return false;
+        return true;
+    }
+
+    inline SolutionSet operator&(const SolutionSet &other) const {
+        SolutionSet s;
+        for (std::size_t i = 0; i < kNWords; i++) s.mBits[i] = mBits[i] & other.mBits[i];
+        return s;
+    }
+
+    inline bool operator==(const SolutionSet &other) const {
+        return mBits == other.mBits;
+    }
+
+    // calls f(id) for each solution in the set, in increasing id order
+    template <typename F>
+    inline void for_each(F f) const {
+        for (std::size_t i = 0; i < kNWords; i++) {
+            for (uint64_t w = mBits[i]; w; w &= w - 1) {
+                f(static_cast<uint16_t>(i * 64 + std::countr_zero(w)));
+            }
+        }
+    }
+
+    inline const uint64_t *data() const {
+        return mBits.data();
+    }
+
+    inline std::size_t hash() const {
+        uint64_t h = 14695981039346656037ull;
+        for (auto w : mBits) {
+            h ^= w;
+            h *= 1099511628211ull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+
+private:
+    std::array<uint64_t, kNWords> mBits;
+};
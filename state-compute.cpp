@@ -1,6 +1,7 @@
 #include "config.h"
 #include "keyboard.h"
 #include "match.h"
+#include "matchtable.h"
 #include "state.h"
 #include "statecache.h"
 #include "threadpool.h"
@@ -10,27 +11,31 @@
 
 namespace {
 void recurse(int level, const std::string &guess, const Keyboard &keyboard, const State::ptr &state, const StateCache::ptr &state_cache) {
+    auto partition = state->partition(guess);
+
     for (std::size_t i = 0; i <= Match::kMaxValue; i++) {
         //if (level == 2) {
-        //    auto fw = state->filtered_words_for_guess(guess, i);
+        //    auto &fw = partition->at(i);
         //    if (state_cache->contains(&fw) && state_cache->at(&fw)->is_fully_computed()) continue;
         //}
 
-        Match m(guess, i);
-        if (level == 0) {
-            for (std::size_t j = 0; j < level; j++) { std::cout << "  "; }
-            std::cout << "Considering guess \"" << guess << "\" with match " << m.toString() << std::endl;
-        }
-        auto t = state->consider_guess(guess, i);
+        if (!partition->at(i).empty()) {
+            Match m(guess, i);
+            if (level == 0) {
+                for (int j = 0; j < level; j++) { std::cout << "  "; }
+                std::cout << "Considering guess \"" << guess << "\" with match " << m.toString() << std::endl;
+            }
+            auto t = state->consider_guess(*partition, i);
 
-        auto l = keyboard.update_with_guess(guess, m);
-        auto e = t->best_guess(l);
+            auto l = keyboard.update_with_guess(guess, m);
+            auto e = t->best_guess(l);
 
-        if (t->n_solutions() == 1) continue;
-        if (level == 2) continue;
+            if (t->n_solutions() == 1) continue;
+            if (level == 2) continue;
 
-        for (auto &se : e) {
-            recurse(level + 1, se.entropy().word().word(), l, t, state_cache);
+            for (auto &se : e) {
+                recurse(level + 1, se.entropy().word().word(), l, t, state_cache);
+            }
         }
         if (level == 0 && (i+1)%10 == 0) {
             std::cout << state_cache->report() << std::endl;
@@ -53,8 +58,9 @@ int main(void) {
     ThreadPool pool;
     StateCache::ptr state_cache(new StateCache);
     Wordlist word_list;
+    MatchTable match_table(pool, word_list);
 
-    State::ptr initial_state(new State(pool, state_cache, word_list.all_words()));
+    State::ptr initial_state(new State(pool, state_cache, word_list, match_table));
     auto p = state_cache->insert(initial_state);
     assert(p.second);
 
@@ -66,6 +72,7 @@ int main(void) {
     recurse(0, "trace", initial_keyboard, initial_state, state_cache);
 
     state_cache->persist();
+    state_cache->wait_for_compaction();
     pool.done();
 
     return 0;
@@ -1,19 +1,23 @@
 // Copyright (c) 2022, Bertrand Mollinier Toublet
 // See LICENSE for details of BSD 3-Clause License
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cmath>
-#include <condition_variable>
 #include <iostream>
 #include <iterator>
 #include <mutex>
 #include <numeric>
 
 #include "config.h"
+#include "endgame.h"
 #include "keyboard.h"
 #include "match.h"
+#include "matchtable.h"
 #include "state.h"
 #include "statecache.h"
 #include "threadpool.h"
+#include "wordlist.h"
 
 std::ostream& operator<<(std::ostream& out, const Word& word) {
     return out << "\"" << word.word() << "\"[" << (word.is_solution() ? 'T' : 'F') << "]";
@@ -43,214 +47,592 @@ ScoredEntropy::ScoredEntropy(const WordEntropy &entropy, const Keyboard &keyboar
 
 namespace {
 
-Words extract_solutions(const std::size_t n_solutions, const Words &words) {
+static_assert(ENDGAME_MAX_N_SOLUTIONS <= Endgame::kMaxNSolutions, "endgame states must fit a uint64_t mask");
+
+Words extract_solutions(const WordIds &solutions, const Words &all_words) {
     Words the_solutions;
 
-    if (n_solutions > MAX_N_SOLUTIONS_PRINTED) {
+    if (solutions.size() > MAX_N_SOLUTIONS_PRINTED) {
         return the_solutions;
     }
 
-    std::remove_copy_if(words.begin(), words.end(), std::back_inserter(the_solutions), [](const Word &word) { return !word.is_solution(); });
-    assert(the_solutions.size() == n_solutions);
+    std::transform(solutions.begin(), solutions.end(), std::back_inserter(the_solutions), [&all_words](uint16_t id) { return all_words[id]; });
+    assert(std::all_of(the_solutions.begin(), the_solutions.end(), [](const Word &word) { return word.is_solution(); }));
 
     return the_solutions;
 }
 
+// entropies are computed from c·log(c), in fixed point, for every bucket size c: for N solutions,
+// H = log(N) - Σ c·log(c) / N
+const double kCLogCScale = 4294967296.; // 2^32
+
+struct CLogCTable {
+    CLogCTable() {
+        for (std::size_t c = 0; c <= N_SOLUTIONS; c++) {
+            values[c] = (c < 2) ? 0 : std::llround(c * std::log(c) * kCLogCScale);
+        }
+    }
+    uint64_t values[N_SOLUTIONS + 1];
+};
+const CLogCTable kCLogC;
+
+// Σ f(c) over the bucket sizes c of the matches of a guess (its match table row) against
+// solutions, f(0) being 0. The histogram is scratch space reused by every call on a thread, and
+// left zeroed: with fewer solutions than buckets, only the ones they hit are read and cleared.
+template <typename F>
+inline uint64_t sum_over_buckets(const uint8_t *matches, const WordIds &solutions, F f) {
+    thread_local uint32_t match_counts[Match::kMaxValue + 1] = {};
+    for (auto id : solutions) {
+        match_counts[matches[id]]++;
+    }
+
+    uint64_t sum = 0;
+    if (solutions.size() <= Match::kMaxValue) {
+        for (auto id : solutions) {
+            uint32_t &cnt = match_counts[matches[id]];
+            sum += f(cnt);
+            cnt = 0;
+        }
+    } else {
+        for (auto &cnt : match_counts) {
+            sum += f(cnt);
+            cnt = 0;
+        }
+    }
+    return sum;
+}
+
+inline uint64_t sum_c_log_c(const uint8_t *matches, const WordIds &solutions) {
+    return sum_over_buckets(matches, solutions, [](uint32_t cnt) { return kCLogC.values[cnt]; });
+}
+
+// Σ c·log(c) to the entropy, in milli-nats, of the buckets of n solutions
+struct EntropyScale {
+    explicit EntropyScale(std::size_t n)
+        : log_n(1000 * std::log(n))
+        , per_sum(1000 / (kCLogCScale * n)) { }
+
+    inline uint32_t entropy(uint64_t sum) const {
+        return static_cast<uint32_t>(std::max(log_n - sum * per_sum, 0.));
+    }
+
+    const double log_n;
+    const double per_sum;
+};
+
+// how many of the solutions have each letter at each position, and anywhere: enough to bound the
+// entropy of a guess by the sum of the entropies of its match at each position. That match is
+// known exactly for a letter the guess has once (correct where the solution has it, present
+// elsewhere in it, absent otherwise), and only as correct or not for a repeated one.
+class LetterCounts {
+public:
+    LetterCounts(const std::vector<uint32_t> &packed_words, const WordIds &solutions)
+        : mN(solutions.size())
+        , mScale(mN)
+        , mCeiling(EntropyScale(std::min<std::size_t>(mN, Match::kMaxValue + 1)).entropy(0))
+        , mAt{}
+        , mIn{} {
+        for (auto id : solutions) {
+            uint32_t letters = 0;
+            for (size_t i = 0; i < WORD_LEN; i++) {
+                uint32_t letter = Match::letter_at(packed_words[id], i);
+                mAt[i][letter]++;
+                letters |= 1u << letter;
+            }
+            for (; letters; letters &= letters - 1) {
+                mIn[std::countr_zero(letters)]++;
+            }
+        }
+    }
+
+    // at least the entropy of guess (as computed by compute_entropy_of), and 0 only if it is 0
+    inline uint32_t entropy_bound(uint32_t guess) const {
+        uint32_t seen = 0, repeated = 0;
+        for (size_t i = 0; i < WORD_LEN; i++) {
+            uint32_t bit = 1u << Match::letter_at(guess, i);
+            repeated |= seen & bit;
+            seen |= bit;
+        }
+
+        bool splits = false;
+        double bound = 0;
+        for (size_t i = 0; i < WORD_LEN; i++) {
+            uint32_t letter = Match::letter_at(guess, i);
+            uint32_t correct = mAt[i][letter];
+            if (mIn[letter] == 0 || correct == mN) continue; // the same match for all
+            if (repeated & (1u << letter)) {
+                splits = true;
+                bound += mScale.log_n - (kCLogC.values[correct] + kCLogC.values[mN - correct]) * mScale.per_sum
+                       + 1000 * std::log(2) * (mN - correct) / mN;
+            }
+            else {
+                uint32_t present = mIn[letter] - correct;
+                splits |= present != mN;
+                bound += mScale.log_n - (kCLogC.values[correct] + kCLogC.values[present] + kCLogC.values[mN - correct - present]) * mScale.per_sum;
+            }
+        }
+        return splits ? std::min(static_cast<uint32_t>(bound) + 1, mCeiling) : 0;
+    }
+
+private:
+    const uint32_t mN;
+    const EntropyScale mScale;
+    const uint32_t mCeiling;
+    uint16_t mAt[WORD_LEN][26];
+    uint16_t mIn[26];
+};
+
+// guesses differing only by letters none of the solutions have split them alike: such letters are
+// replaced by a wildcard in the key guesses are grouped by, and each group is computed once
+const uint32_t kWildcard = 0x1f;
+
+inline uint32_t equivalence_key_of(uint32_t packed, uint32_t absent_letters) {
+    for (size_t i = 0; i < WORD_LEN; i++) {
+        if (absent_letters & (1u << Match::letter_at(packed, i))) {
+            packed |= kWildcard << (5 * i);
+        }
+    }
+    return packed;
+}
+
+// equivalence keys to values, for at most one key per word: open addressing in per-thread
+// scratch space, cleared in constant time by moving on to a new generation (so not to be held
+// across anything that may use it too)
+class KeyMap {
+public:
+    static const std::size_t kNSlotsLog2 = 15;
+    static const std::size_t kNSlots = 1 << kNSlotsLog2;
+
+    static inline KeyMap &cleared() {
+        thread_local KeyMap map;
+        if (++map.mGeneration == 0) {
+            std::fill(std::begin(map.mGenerations), std::end(map.mGenerations), 0);
+            map.mGeneration = 1;
+        }
+        return map;
+    }
+
+    // the value of key, newly inserted as value if absent
+    inline uint32_t &emplace(uint32_t key, uint32_t value, bool &inserted) {
+        std::size_t slot = (key * 0x9e3779b1u) >> (32 - kNSlotsLog2);
+        while (mGenerations[slot] == mGeneration && mKeys[slot] != key) {
+            slot = (slot + 1) & (kNSlots - 1);
+        }
+        inserted = mGenerations[slot] != mGeneration;
+        if (inserted) {
+            mGenerations[slot] = mGeneration;
+            mKeys[slot] = key;
+            mValues[slot] = value;
+        }
+        return mValues[slot];
+    }
+
+private:
+    uint32_t mGeneration = 0;
+    uint32_t mGenerations[kNSlots] = {};
+    uint32_t mKeys[kNSlots];
+    uint32_t mValues[kNSlots];
+};
+
+// the scored entropies of the highest score
+std::vector<ScoredEntropy> best_scored(std::vector<ScoredEntropy> &scored_entropy) {
+    std::sort(scored_entropy.begin(), scored_entropy.end());
+
+    auto scored_recommended_guesses_end = scored_entropy.begin();
+    while (scored_recommended_guesses_end != scored_entropy.end() && scored_entropy.front().score() == scored_recommended_guesses_end->score()) {
+        scored_recommended_guesses_end++;
+    }
+    return std::vector<ScoredEntropy>(scored_entropy.begin(), scored_recommended_guesses_end);
+}
+
+SolutionSet solution_set_of(const WordIds &solutions) {
+    SolutionSet the_solution_set;
+    std::for_each(solutions.begin(), solutions.end(), [&the_solution_set](uint16_t id) { the_solution_set.set(id); });
+    return the_solution_set;
+}
+
+WordIds all_solution_ids(const Wordlist &word_list) {
+    WordIds ids(word_list.n_solutions());
+    std::iota(ids.begin(), ids.end(), 0);
+    return ids;
+}
+
 } // namespace anonymous
 
-State::State(ThreadPool &pool, const StateCache::ptr &state_cache, const Words &all_words)
+State::State(ThreadPool &pool, const StateCache::ptr &state_cache, const Wordlist &word_list, const MatchTable &match_table)
     : mPool(pool)
     , mStateCache(state_cache)
-    , mAllWords(all_words)
-    , mWords(all_words)
-    , mNSolutions(std::transform_reduce(mWords.begin(), mWords.end(), 0, std::plus(), [](const Word &word) -> size_t { return word.is_solution() ? 1 : 0; }))
-    , mSolutions(extract_solutions(mNSolutions, mWords))
+    , mWordList(word_list)
+    , mMatchTable(match_table)
+    , mAllWords(word_list.all_words())
+    , mWords(all_solution_ids(mWordList))
+    , mNSolutions(mWords.size())
+    , mSolutions(extract_solutions(mWords, mAllWords))
+    , mSolutionSet(solution_set_of(mWords))
+    , mFingerprint(fingerprint_of(mWords))
+    , mGuesses(std::make_shared<const WordIds>(word_list.all_word_ids()))
     , mFullyComputed(false) { }
 
-void State::compute_entropy2() const {
+void State::compute_entropy2(Computed &computed) const {
 #if DEBUG_ENTROPY
     std::cout << "Computing entropy..." << std::flush;
 #endif // DEBUG_ENTROPY
 
-    /* 3. compute entropy2 */
-    std::mutex lock;
-    unsigned ndone = 0;
-    std::condition_variable cond;
-
-    mEntropy2 = std::vector<WordEntropy>();
-    const size_t num_blocks = mPool.num_threads();
-    const size_t block_sz = ENTROPY_2_TOP_N / num_blocks + 1;
-    ndone = 0;
-
-    for (size_t i = 0; i < num_blocks; i++) {
-        mPool.push([i, block_sz, this, &lock, &ndone, &cond]() {
-                std::vector<WordEntropy> block_entropy;
-                block_entropy.reserve(block_sz);
-                for (auto j = i * block_sz; j < (i+1) * block_sz && j < ENTROPY_2_TOP_N && j < mEntropy.size(); j++) {
-                    const WordEntropy &we = mEntropy.at(j);
-                    block_entropy.push_back(WordEntropy(we.word(), we.entropy() + compute_entropy2_of(we.word().word())));
-                }
-                {
-                    std::lock_guard<std::mutex> lk(lock);
-                    mEntropy2.insert(mEntropy2.end(), block_entropy.begin(), block_entropy.end());
-                    ndone += 1;
-#if DEBUG_ENTROPY
-                    std::cout << "." << std::flush;
-#endif // DEBUG_ENTROPY
-                }
-                cond.notify_all();
-            });
+    if (computed.entropy.empty() && mNSolutions > 2) { // an inner state, until now
+        compute_entropy(computed);
+    }
+    if (mNSolutions <= ENDGAME_MAX_N_SOLUTIONS) {
+        // played exactly: best_guess() has no use for entropy2, and what is displayed of it is
+        // computed when asked for
+        return;
     }
+    const std::vector<WordEntropy> &entropy = computed.entropy;
+
+    /* 3. compute entropy2, best entropy first. A candidate can't beat its entropy plus the most
+     * its buckets could be split further (log(min(243, n)) for n solutions): candidates that
+     * can't reach the best entropy2 found so far are skipped, or given up on as computing their
+     * buckets tightens that bound; and once even splitting perfectly wouldn't do, so are all the
+     * candidates after. */
+    const std::size_t n_candidates = std::min<std::size_t>(ENTROPY_2_TOP_N, entropy.size());
+    const uint32_t ceiling = static_cast<uint32_t>(1000 * std::log(std::min<std::size_t>(mNSolutions, Match::kMaxValue + 1))) + 1;
+    std::atomic<uint32_t> best_entropy2(0);
+    std::vector<uint32_t> entropy2(n_candidates);
+    std::vector<std::shared_ptr<const Partition>> partitions(n_candidates);
+
+    // equivalent guesses share their entropy2 and partition: only the first of each is computed
+    std::vector<std::size_t> representative(n_candidates);
     {
-        std::unique_lock<std::mutex> lk(lock);
-        cond.wait(lk, [&ndone, num_blocks]() { return ndone == num_blocks; });
+        const auto &packed_words = mWordList.packed_words();
+        const uint32_t absent = absent_letters();
+        KeyMap &first_of_key = KeyMap::cleared();
+        for (std::size_t j = 0; j < n_candidates; j++) {
+            bool inserted;
+            representative[j] = first_of_key.emplace(equivalence_key_of(packed_words[entropy[j].word().id()], absent), j, inserted);
+        }
+    }
+
+    mPool.parallel_for(0, n_candidates, 1, [this, ceiling, &entropy, &representative, &best_entropy2, &entropy2, &partitions](std::size_t j) {
+            if (representative[j] != j) {
+                return;
+            }
+            const WordEntropy &we = entropy[j];
+            const uint32_t threshold = best_entropy2.load(std::memory_order_relaxed);
+            if (we.entropy() + ceiling < threshold || entropy2_bound_of(we.word(), we.entropy()) < threshold) {
+                return;
+            }
+
+            auto p = partition(we.word());
+            uint32_t h = compute_entropy2_of(we, *p, threshold);
+            if (h == 0) {
+                return;
+            }
+            partitions[j] = p;
+            entropy2[j] = h;
+
+            uint32_t best = best_entropy2.load(std::memory_order_relaxed);
+            while (h > best && !best_entropy2.compare_exchange_weak(best, h, std::memory_order_relaxed)) { }
+        });
+
+    computed.entropy2.clear();
+    for (std::size_t j = 0; j < n_candidates; j++) {
+        if (partitions[representative[j]]) {
+            computed.entropy2.push_back(WordEntropy(entropy[j].word(), entropy2[representative[j]]));
+        }
     }
-#if DEBUG_ENTROPY
-    std::cout << std::endl;
-#endif // DEBUG_ENTROPY
 
     /* 4. sort entropy2 decreasing */
-    std::sort(mEntropy2.begin(), mEntropy2.end());
+    std::sort(computed.entropy2.begin(), computed.entropy2.end());
 
-    if (mEntropy2.size() > 0) mStateCache->make_dirty();
+    /* 5. hang on to the partitions of the guesses the user is most likely to make next */
+    computed.partitions.clear();
+    for (auto it = computed.entropy2.begin(); it != computed.entropy2.end() && it - computed.entropy2.begin() < N_PARTITIONS_KEPT; it++) {
+        auto j = std::find_if(entropy.begin(), entropy.begin() + n_candidates, [it](const WordEntropy &e) { return e.word().id() == it->word().id(); }) - entropy.begin();
+        computed.partitions.push_back(std::make_pair(it->word().id(), partitions[representative[j]]));
+    }
+}
 
-    /* 5. find the end of the highest entropy set */
-    mHighestEntropy2End = mEntropy2.begin();
-    while (mHighestEntropy2End != mEntropy2.end() && mEntropy2.front().entropy() == mHighestEntropy2End->entropy()) {
-        mHighestEntropy2End++;
+// computes what this state lacks, if anything, without holding mComputeLock across the pool's waits:
+// a thread waiting on the lock would never get to help
+void State::compute_fully() const {
+    Computed computed;
+    {
+        std::lock_guard<std::mutex> lk(mComputeLock);
+        if (mFullyComputed) return;
+        computed.max_entropy = mMaxEntropy;
+        computed.entropy = mEntropy;
+        computed.guesses = mGuesses;
     }
+    compute_entropy2(computed);
+    install(computed);
+}
+
+void State::install(Computed &computed) const {
+    {
+        std::lock_guard<std::mutex> lk(mComputeLock);
+        if (mFullyComputed) return; // by another thread sharing this state
 
-    /* 6. this state is now fully computed! */
-    mFullyComputed = true;
+        mMaxEntropy = computed.max_entropy;
+        mEntropy = std::move(computed.entropy);
+        mGuesses = computed.guesses;
+        mEntropy2 = std::move(computed.entropy2);
+
+        /* 6. find the end of the highest entropy set */
+        mHighestEntropy2End = mEntropy2.begin();
+        while (mHighestEntropy2End != mEntropy2.end() && mEntropy2.front().entropy() == mHighestEntropy2End->entropy()) {
+            mHighestEntropy2End++;
+        }
+
+        /* 7. this state is now fully computed! */
+        mFullyComputed = true;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mPartitionsLock);
+        for (auto &p : computed.partitions) {
+            mPartitions.emplace(p.first, p.second);
+        }
+    }
+    if (!mEntropy2.empty()) mStateCache->make_dirty(*this);
 }
 
-State::State(const State &other, const Words &filtered_words, bool do_full_compute)
+State::State(const State &other, const WordIds &filtered_solutions, bool do_full_compute)
     : mPool(other.mPool)
     , mStateCache(other.mStateCache)
+    , mWordList(other.mWordList)
+    , mMatchTable(other.mMatchTable)
     , mAllWords(other.mAllWords)
-    , mWords(filtered_words)
-    , mNSolutions(std::transform_reduce(mWords.begin(), mWords.end(), 0, std::plus(), [](const Word &word) -> size_t { return word.is_solution() ? 1 : 0; }))
-    , mSolutions(extract_solutions(mNSolutions, mWords))
+    , mWords(filtered_solutions)
+    , mNSolutions(mWords.size())
+    , mSolutions(extract_solutions(mWords, mAllWords))
+    , mSolutionSet(solution_set_of(mWords))
+    , mFingerprint(fingerprint_of(mWords))
+    , mGuesses(other.guesses())
     , mMaxEntropy(0)
-    , mFullyComputed(do_full_compute) {
+    , mFullyComputed(false) {
+
+    if (do_full_compute) {
+        Computed computed;
+        computed.guesses = mGuesses;
+        compute_entropy(computed);
+        compute_entropy2(computed);
+        install(computed);
+    }
+    else if (mNSolutions > 2) {
+        // an inner state, whose max entropy is all compute_entropy2_of needs: the rest of its
+        // entropy is only computed if it ever gets fully computed
+        mMaxEntropy = compute_max_entropy();
+    }
+}
+
+void State::compute_entropy(Computed &computed) const {
+    std::vector<WordEntropy> &entropy = computed.entropy;
 
     /* 1. compute entropy */
     if (mNSolutions > 2) {
-        if (do_full_compute) {
-            std::mutex lock;
-            unsigned ndone = 0;
-            std::condition_variable cond;
-
-            mEntropy = std::vector<WordEntropy>();
-            const size_t num_blocks = mPool.num_threads();
-            const size_t block_sz = mAllWords.size() / num_blocks + 1;
-
-            for (size_t i = 0; i < num_blocks; i++) {
-                mPool.push([i, block_sz, this, &lock, &ndone, &cond]() {
-                        std::vector<WordEntropy> block_entropy;
-                        uint32_t max_h = 0, threshold = 0;
-                        for (auto j = i * block_sz; j < (i+1) * block_sz && j < mAllWords.size(); j++) {
-                            const Word &word = mAllWords.at(j);
-                            auto h = compute_entropy_of(word.word());
-                            if (h > max_h) { max_h = h; threshold = max_h * ENTROPY_RATIO; }
-                            if (h >= threshold && h > 0) {
-                                block_entropy.push_back(WordEntropy(word, h));
-                            }
-                        }
-                        {
-                            std::lock_guard<std::mutex> lk(lock);
-                            mEntropy.insert(mEntropy.end(), block_entropy.begin(), block_entropy.end());
-                            ndone += 1;
-#if DEBUG_ENTROPY
-                            std::cout << "." << std::flush;
-#endif // DEBUG_ENTROPY
-                        }
-                        cond.notify_all();
-                    });
+        // one representative (the first word) per group of equivalent guesses
+        const auto &packed_words = mWordList.packed_words();
+        const uint32_t absent = absent_letters();
+        const std::shared_ptr<const WordIds> all_guesses = computed.guesses;
+        const WordIds &guesses = *all_guesses;
+        KeyMap &group_of_key = KeyMap::cleared();
+        WordIds representatives;
+        std::vector<uint16_t> group_of(guesses.size());
+        for (std::size_t j = 0; j < guesses.size(); j++) {
+            bool inserted;
+            group_of[j] = group_of_key.emplace(equivalence_key_of(packed_words[guesses[j]], absent), representatives.size(), inserted);
+            if (inserted) representatives.push_back(guesses[j]);
+        }
+
+        // groups are computed by decreasing upper bound of their entropy: the ones that can't reach
+        // ENTROPY_RATIO of the best entropy so far are skipped, and left unknown
+        const uint32_t kUnknown = std::numeric_limits<uint32_t>::max();
+        const LetterCounts letter_counts(packed_words, mWords);
+        std::vector<uint32_t> group_entropy(representatives.size(), kUnknown);
+        std::vector<uint32_t> group_bound(representatives.size());
+        std::vector<uint32_t> order;
+        order.reserve(representatives.size());
+        for (std::size_t g = 0; g < representatives.size(); g++) {
+            group_bound[g] = letter_counts.entropy_bound(packed_words[representatives[g]]);
+            if (group_bound[g] == 0) {
+                group_entropy[g] = 0;
             }
-            {
-                std::unique_lock<std::mutex> lk(lock);
-                cond.wait(lk, [&ndone, num_blocks]() { return ndone == num_blocks; });
+            else {
+                order.push_back(g);
             }
         }
-        else {
-            uint32_t max_h = 0, threshold = 0;
-            mEntropy.reserve(mAllWords.size());
-            for (auto &word : mAllWords) {
-                auto h = compute_entropy_of(word.word());
-                if (h > max_h) { max_h = h; threshold = max_h * ENTROPY_RATIO; }
-                if (h >= threshold && h > 0) {
-                    mEntropy.push_back(WordEntropy(word, h));
+        std::sort(order.begin(), order.end(), [&group_bound](uint32_t lhs, uint32_t rhs) { return group_bound[lhs] > group_bound[rhs]; });
+
+        std::atomic<uint32_t> max_h(0);
+        mPool.parallel_for(0, order.size(), 64, [this, &representatives, &order, &group_bound, &group_entropy, &max_h](std::size_t k) {
+                uint32_t g = order[k];
+                uint32_t best = max_h.load(std::memory_order_relaxed);
+                if (group_bound[g] < static_cast<uint32_t>(best * ENTROPY_RATIO)) {
+                    return;
                 }
+                uint32_t h = compute_entropy_of(mAllWords[representatives[g]]);
+                group_entropy[g] = h;
+                while (h > best && !max_h.compare_exchange_weak(best, h, std::memory_order_relaxed)) { }
+            });
+
+        // a guess leaving all the solutions in one bucket does so for any subset of them: the
+        // states following this one need not consider it (with at most N_SOLUTIONS solutions, any
+        // other split is worth at least a milli-nat)
+        const uint32_t threshold = max_h.load() * ENTROPY_RATIO;
+        auto useful_guesses = std::make_shared<WordIds>();
+        useful_guesses->reserve(guesses.size());
+        for (std::size_t j = 0; j < guesses.size(); j++) {
+            auto h = group_entropy[group_of[j]];
+            if (h > 0) {
+                useful_guesses->push_back(guesses[j]);
             }
+            if (h != kUnknown && h >= threshold && h > 0) {
+                entropy.push_back(WordEntropy(mAllWords[guesses[j]], h));
+            }
+        }
+        if (useful_guesses->size() < guesses.size()) {
+            useful_guesses->shrink_to_fit();
+            computed.guesses = useful_guesses;
+
+            // published now, not at install(): the states compute_entropy2() considers copy it
+            std::lock_guard<std::mutex> lk(mComputeLock);
+            mGuesses = useful_guesses;
         }
     }
 
     /* 2. sort entropy decreasing */
-    std::sort(mEntropy.begin(), mEntropy.end());
+    std::sort(entropy.begin(), entropy.end());
 
-    if (mEntropy.size() > 0) {
-        mMaxEntropy = mEntropy.at(0).entropy();
+    if (entropy.size() > 0) {
+        computed.max_entropy = entropy.at(0).entropy();
 
         /* ok, but we gotta prune some out */
-        const uint32_t threshold = mMaxEntropy * 0.9;
+        const uint32_t threshold = computed.max_entropy * 0.9;
 #if DEBUG_ENTROPY
         size_t n_removed = 0;
 #endif // DEBUG_ENTROPY
-        while (mEntropy.size() > 0 && mEntropy.back().entropy() < threshold) {
-            mEntropy.pop_back();
+        while (entropy.size() > 0 && entropy.back().entropy() < threshold) {
+            entropy.pop_back();
 #if DEBUG_ENTROPY
             n_removed++;
 #endif // DEBUG_ENTROPY
         }
 #if DEBUG_ENTROPY
-        std::cout << "Purged " << n_removed << " entropy entries with threshold too low; down to " << mEntropy.size() << " entries." << std::endl;
+        std::cout << "Purged " << n_removed << " entropy entries with threshold too low; down to " << entropy.size() << " entries." << std::endl;
 #endif // DEBUG_ENTROPY
     }
     else {
-        mMaxEntropy = 0;
+        computed.max_entropy = 0;
     }
+}
 
-    if (do_full_compute) {
-        compute_entropy2();
+Word State::resolve(const std::string &guess) const {
+    const Word *word = mWordList.find(guess);
+    if (word) return *word;
+
+    // not in the word list: no precomputed matches for it
+    return Word(guess, false);
+}
+
+WordIds State::filtered_words_for_guess(const std::string &guess, uint32_t match) const {
+    return filtered_words_for_guess(resolve(guess), match);
+}
+
+std::vector<uint8_t> State::match_values(const Word &guess) const {
+    std::vector<uint8_t> values(mWords.size());
+    if (guess.id() != Word::kNoId) {
+        const uint8_t *matches = mMatchTable.row(guess.id());
+        std::transform(mWords.begin(), mWords.end(), values.begin(), [matches](uint16_t id) { return matches[id]; });
     }
+    else {
+        // not in the word list: no precomputed matches for it
+        std::transform(mWords.begin(), mWords.end(), values.begin(), [this, &guess](uint16_t id) { return Match(guess.word(), mAllWords[id].word()).value(); });
+    }
+    return values;
 }
 
-Words State::filtered_words_for_guess(const std::string &guess, uint32_t match) const {
-    Match m(guess, match);
+WordIds State::filtered_words_for_guess(const Word &guess, uint32_t match) const {
+    Match m(guess.word(), match);
 
-    Words filtered_words;
-    std::copy_if(mWords.begin(), mWords.end(),
-            std::back_inserter(filtered_words),
-            [guess, match](const Word &w) {
-                Match n(guess, w.word());
-#if DEBUG_ACCEPT_WORDS
-                if (n.value() == match) { std::cout << "Accepting word \"" << w.word() << "\" with match " << n.toString() << std::endl; }
-#endif
+    WordIds filtered_solutions;
+    if (guess.id() != Word::kNoId) {
+        SolutionSet filtered_solution_set = mSolutionSet & mMatchTable.mask(guess.id(), match);
+        filtered_solution_set.for_each([&filtered_solutions](uint16_t id) { filtered_solutions.push_back(id); });
+    }
+    else {
+        std::vector<uint8_t> values = match_values(guess);
+        for (std::size_t i = 0; i < values.size(); i++) {
 #if DEBUG_REJECT_WORDS
-                std::cout << "Considering word \"" << w.word() << "\" with match " << n.toString() << ": " << (n.value() == m.value() ? "accept" : "reject") << std::endl;
+            std::cout << "Considering word \"" << mAllWords[mWords[i]].word() << "\" with match " << Match(guess.word(), values[i]).toString() << ": " << (values[i] == m.value() ? "accept" : "reject") << std::endl;
 #endif
-               return n.value() == match;
-            });
-    return filtered_words;
+            if (values[i] == match) {
+                filtered_solutions.push_back(mWords[i]);
+            }
+        }
+    }
+#if DEBUG_ACCEPT_WORDS
+    for (auto id : filtered_solutions) { std::cout << "Accepting word \"" << mAllWords[id].word() << "\" with match " << m.toString() << std::endl; }
+#endif
+    return filtered_solutions;
+}
+
+std::shared_ptr<const State::Partition> State::partition(const std::string &guess) const {
+    return partition(resolve(guess));
+}
+
+std::shared_ptr<const State::Partition> State::partition(const Word &guess) const {
+    if (guess.id() != Word::kNoId) {
+        std::lock_guard<std::mutex> lk(mPartitionsLock);
+        auto it = mPartitions.find(guess.id());
+        if (it != mPartitions.end()) return it->second;
+    }
+
+    std::vector<uint8_t> values = match_values(guess);
+
+    // single pass; buckets come out sorted since mWords is
+    std::shared_ptr<Partition> the_partition(new Partition(Match::kMaxValue + 1));
+    for (std::size_t i = 0; i < mWords.size(); i++) {
+        (*the_partition)[values[i]].push_back(mWords[i]);
+    }
+    return the_partition;
 }
 
 State::ptr State::consider_guess(const std::string &guess, uint32_t match, bool do_full_compute) const {
-    Words filtered_words = filtered_words_for_guess(guess, match);
+    return consider_guess(resolve(guess), match, do_full_compute);
+}
 
-    if (mStateCache->contains(&filtered_words)) {
+State::ptr State::consider_guess(const Word &guess, uint32_t match, bool do_full_compute) const {
+    if (guess.id() != Word::kNoId) {
+        std::unique_lock<std::mutex> lk(mPartitionsLock);
+        auto it = mPartitions.find(guess.id());
+        if (it != mPartitions.end()) {
+            auto the_partition = it->second;
+            lk.unlock();
+            return consider_guess(*the_partition, match, do_full_compute);
+        }
+    }
+
+    return consider_solutions(filtered_words_for_guess(guess, match), do_full_compute);
+}
+
+State::ptr State::consider_guess(const Partition &partition, uint32_t match, bool do_full_compute) const {
+    return consider_solutions(partition.at(match), do_full_compute);
+}
+
+State::ptr State::consider_solutions(const WordIds &filtered_solutions, bool do_full_compute) const {
+    SolutionSet filtered_solution_set = solution_set_of(filtered_solutions);
+    StateKey key{ fingerprint_of(filtered_solutions), &filtered_solution_set };
+    if (auto cached = mStateCache->find(key)) {
 #if DEBUG_STATE_CACHE
         std::cout << "+" << std::flush;
 #endif // DEBUG_STATE_CACHE
 
-        return mStateCache->at(&filtered_words);
+        return cached;
     }
     else {
 #if DEBUG_STATE_CACHE
         std::cout << "-" << std::flush;
 #endif // DEBUG_STATE_CACHE
 
-        State::ptr s(new State(*this, filtered_words, do_full_compute));
+        State::ptr s(new State(*this, filtered_solutions, do_full_compute));
         if (s->n_solutions() != 0) {
             mStateCache->insert(s);
         }
@@ -258,67 +640,150 @@ State::ptr State::consider_guess(const std::string &guess, uint32_t match, bool
     }
 }
 
-uint32_t State::compute_entropy_of(const std::string &word) const {
-    std::vector<uint32_t> match_counts(Match::kMaxValue + 1, 0);
+// the letters none of the solutions have
+uint32_t State::absent_letters() const {
+    const auto &letter_masks = mWordList.letter_masks();
+    uint32_t present = 0;
+    for (auto id : mWords) {
+        present |= letter_masks[id];
+    }
+    return ~present & ((1u << 26) - 1);
+}
 
-    for (auto solution : mWords) {
-        if (!solution.is_solution()) continue;
+uint32_t State::compute_entropy_of(const Word &word) const {
+    return EntropyScale(mNSolutions).entropy(sum_c_log_c(mMatchTable.row(word.id()), mWords));
+}
 
-        Match m(word, solution.word());
-        match_counts[m.value()]++;
+// the max of compute_entropy_of over all words, without keeping any: once a guess tells all the
+// solutions apart (or splits them in 243 equal buckets), none can do better. The state's own
+// solutions are tried first, being the likeliest to.
+uint32_t State::compute_max_entropy() const {
+    const EntropyScale scale(mNSolutions);
+    const uint32_t ceiling = EntropyScale(std::min<std::size_t>(mNSolutions, Match::kMaxValue + 1)).entropy(0);
+    uint32_t max_h = 0;
+
+    auto try_guess = [this, &scale, ceiling, &max_h](uint16_t guess) {
+        max_h = std::max(max_h, scale.entropy(sum_c_log_c(mMatchTable.row(guess), mWords)));
+        return max_h >= ceiling;
+    };
+
+    for (auto id : mWords) {
+        if (try_guess(id)) return max_h;
     }
 
-    double H = 0;
-    for (auto cnt : match_counts) {
-        if (cnt == 0) continue;
-        double Pxi = (double)cnt / mNSolutions;
-        H -= Pxi * std::log(Pxi);
+    // then every other word, once per group of equivalent guesses
+    const auto &packed_words = mWordList.packed_words();
+    const auto &letter_masks = mWordList.letter_masks();
+    const uint32_t absent = absent_letters();
+    const LetterCounts letter_counts(packed_words, mWords);
+    KeyMap &keys_seen = KeyMap::cleared();
+    for (auto id : *mGuesses) {
+        if (id < N_SOLUTIONS && mSolutionSet.test(id)) continue;
+        if (letter_masks[id] & absent) {
+            bool inserted;
+            keys_seen.emplace(equivalence_key_of(packed_words[id], absent), 0, inserted);
+            if (!inserted) continue;
+        }
+        if (letter_counts.entropy_bound(packed_words[id]) <= max_h) continue;
+        if (try_guess(id)) return max_h;
     }
-    return static_cast<uint32_t>(H * 1000);
+    return max_h;
 }
 
-uint32_t State::compute_entropy2_of(const std::string &word) const {
-    std::vector<uint32_t> match_counts(Match::kMaxValue + 1, 0);
-
-    for (auto solution : mWords) {
-        if (!solution.is_solution()) continue;
+// an upper bound of entropy + compute_entropy2_of(word): a bucket of n solutions can't be split in
+// more than min(243, n) parts
+uint32_t State::entropy2_bound_of(const Word &word, uint32_t entropy) const {
+    // Σ c·log(min(c, 243)) / N
+    const uint64_t log_max = kCLogC.values[Match::kMaxValue + 1] / (Match::kMaxValue + 1);
+    uint64_t sum = sum_over_buckets(mMatchTable.row(word.id()), mWords, [log_max](uint32_t cnt) {
+        return (cnt <= Match::kMaxValue + 1) ? kCLogC.values[cnt] : cnt * log_max;
+    });
+    return entropy + static_cast<uint32_t>(sum * 1000 / (kCLogCScale * mNSolutions)) + 2;
+}
 
-        Match m(word, solution.word());
-        match_counts[m.value()]++;
+// entropy + the expected max entropy after guessing it, or 0 as soon as it is sure to be below
+// threshold: the largest buckets, which weigh the most, are computed first, and the bound of
+// entropy2_bound_of holds for the others
+uint32_t State::compute_entropy2_of(const WordEntropy &we, const Partition &partition, uint32_t threshold) const {
+    std::vector<const WordIds *> buckets;
+    buckets.reserve(partition.size());
+    double H_bound = 0;
+    for (auto &solutions : partition) {
+        if (solutions.empty()) continue;
+        buckets.push_back(&solutions);
+        if (solutions.size() > 1) {
+            H_bound += (double)solutions.size() / mNSolutions * std::log(std::min<std::size_t>(solutions.size(), Match::kMaxValue + 1)) * 1000;
+        }
     }
+    std::sort(buckets.begin(), buckets.end(), [](const WordIds *lhs, const WordIds *rhs) { return lhs->size() > rhs->size(); });
 
     double H = 0;
-    for (unsigned match = 0; match < match_counts.size(); match++) {
-        if (match_counts[match] == 0) continue;
-
-        auto s = consider_guess(word, match, false);
-        auto H_2 = s->max_entropy();
-        double Pxi = (double)match_counts[match] / mNSolutions;
-        H += Pxi * H_2;
+    for (auto solutions : buckets) {
+        double Pxi = (double)solutions->size() / mNSolutions;
+        if (solutions->size() > 1) {
+            auto s = consider_solutions(*solutions, false);
+            H += Pxi * s->max_entropy();
+            H_bound -= Pxi * std::log(std::min<std::size_t>(solutions->size(), Match::kMaxValue + 1)) * 1000;
+        }
+        if (we.entropy() + static_cast<uint32_t>(H + std::max(H_bound, 0.)) + 1 < threshold) {
+            return 0;
+        }
     }
-    return static_cast<uint32_t>(H);
+    return we.entropy() + static_cast<uint32_t>(H);
 }
 
 uint32_t State::max_entropy() const {
-    return mMaxEntropy;
+    return mMaxEntropy.load(std::memory_order_relaxed);
+}
+
+std::size_t State::n_entropies() const {
+    std::lock_guard<std::mutex> lk(mComputeLock);
+    return mEntropy.size();
+}
+
+bool State::is_fully_computed() const {
+    std::lock_guard<std::mutex> lk(mComputeLock);
+    return mFullyComputed;
+}
+
+std::shared_ptr<const WordIds> State::guesses() const {
+    std::lock_guard<std::mutex> lk(mComputeLock);
+    return mGuesses;
 }
 
 uint32_t State::entropy_of(const std::string &word) const {
-    auto it = std::find_if(mEntropy.begin(), mEntropy.end(), [word](const WordEntropy &e){ return e.word().word() == word; });
-    if (it == mEntropy.end()) return 0;
+    // one row of the match table: cheaper than looking it up in mEntropy, which may not hold it
+    Word w = resolve(word);
+    if (w.id() == Word::kNoId || mNSolutions == 0) return 0;
 
-    return it->entropy();
+    return compute_entropy_of(w);
 }
 
 uint32_t State::entropy2_of(const std::string &word) const {
-    auto it = std::find_if(mEntropy2.begin(), mEntropy2.end(), [word](const WordEntropy &e){ return e.word().word() == word; });
-    if (it == mEntropy2.end()) return 0;
+    {
+        std::lock_guard<std::mutex> lk(mComputeLock);
+        auto it = std::find_if(mEntropy2.begin(), mEntropy2.end(), [word](const WordEntropy &e){ return e.word().word() == word; });
+        if (it != mEntropy2.end()) return it->entropy();
+    }
 
-    return it->entropy();
+    // not kept (pruned by its bound, or not computed yet): computed now, in full
+    Word w = resolve(word);
+    if (w.id() == Word::kNoId || mNSolutions == 0) return 0;
+
+    const Word &the_word = mAllWords[w.id()];
+    return compute_entropy2_of(WordEntropy(the_word, compute_entropy_of(the_word)), *partition(the_word));
 }
 
-bool State::words_equal_to(const Words &other_words) const {
-    return std::equal_to<Words>{}(mWords, other_words);
+std::vector<WordEntropy> State::solution_entropies() const {
+    std::vector<WordEntropy> the_entropies;
+    for (auto &word : mSolutions) {
+        the_entropies.push_back(WordEntropy(mAllWords[word.id()], entropy2_of(word.word())));
+    }
+    return the_entropies;
+}
+
+bool State::solutions_equal_to(const SolutionSet &other_solutions) const {
+    return mSolutionSet == other_solutions;
 }
 
 std::vector<ScoredEntropy> State::best_guess(const Keyboard &keyboard) const {
@@ -330,7 +795,7 @@ std::vector<ScoredEntropy> State::best_guess(const Keyboard &keyboard) const {
         return best_guesses;
     }
     if (mNSolutions == 1) {
-        WordEntropy we(mSolutions.at(0), 0);
+        WordEntropy we(mAllWords[mWords.front()], 0);
         ScoredEntropy se(we, 0);
         best_guesses.push_back(se);
 
@@ -338,61 +803,159 @@ std::vector<ScoredEntropy> State::best_guess(const Keyboard &keyboard) const {
         return best_guesses;
     }
 
-    if (!mFullyComputed) {
-        compute_entropy2();
-    }
-
     std::vector<ScoredEntropy> scored_entropy;
-    for (auto jt = mEntropy2.begin(); jt != mHighestEntropy2End; jt++) {
-        scored_entropy.push_back(ScoredEntropy(*jt, keyboard));
-    }
-    std::sort(scored_entropy.begin(), scored_entropy.end());
+    if (mNSolutions <= ENDGAME_MAX_N_SOLUTIONS) {
+        // few enough solutions to play exactly; kept, as every game reaching this state asks. Like
+        // compute_fully(), searched off the lock, by whichever boards sharing this state get here first
+        std::optional<WordIds> endgame_guesses;
+        std::shared_ptr<const WordIds> guesses;
+        {
+            std::lock_guard<std::mutex> lk(mComputeLock);
+            endgame_guesses = mEndgameGuesses;
+            guesses = mGuesses;
+        }
+        if (!endgame_guesses) {
+            endgame_guesses = Endgame(mMatchTable, mWords, *guesses).best_guesses();
 
-    auto scored_recommended_guesses_end = scored_entropy.begin();
-    while (scored_recommended_guesses_end != scored_entropy.end() && scored_entropy.front().score() == scored_recommended_guesses_end->score()) {
-        scored_recommended_guesses_end++;
+            std::lock_guard<std::mutex> lk(mComputeLock);
+            if (!mEndgameGuesses) mEndgameGuesses = endgame_guesses;
+        }
+        for (auto id : *endgame_guesses) {
+            scored_entropy.push_back(ScoredEntropy(WordEntropy(mAllWords[id], compute_entropy_of(mAllWords[id])), keyboard));
+        }
     }
+    else {
+        compute_fully();
 
-    best_guesses = std::vector<ScoredEntropy>(scored_entropy.begin(), scored_recommended_guesses_end);
-    return best_guesses;
+        // left alone once fully computed
+        for (auto jt = mEntropy2.begin(); jt != mHighestEntropy2End; jt++) {
+            scored_entropy.push_back(ScoredEntropy(*jt, keyboard));
+        }
+    }
+    return best_scored(scored_entropy);
 }
 
-void State::serialize(std::ostream & os) const {
-    os.put(mFullyComputed);
-
-    assert(mWords.size() <= std::numeric_limits<uint32_t>::max());
-    uint32_t sz = mWords.size();
-    os.write(reinterpret_cast<char *>(&sz), sizeof sz);
-
-    std::for_each(mWords.begin(), mWords.end(), [&os](const Word &w) { w.serialize(os); });
+std::vector<ScoredEntropy> State::joint_best_guess(const std::vector<ptr> &states, const std::vector<Keyboard> &keyboards) {
+    assert(states.size() == keyboards.size());
+    std::vector<ScoredEntropy> best_guesses;
+    if (states.empty()) {
+        return best_guesses;
+    }
+    const State &any = *states.front();
+    const auto &packed_words = any.mWordList.packed_words();
+
+    // a guess is worth its entropy on each board, plus, on a board it may be the solution of, the
+    // bonus of solving it outright, times the odds that it does
+    struct Board {
+        const State &state;
+        const Keyboard &keyboard;
+        const EntropyScale scale;
+        const LetterCounts letter_counts;
+        const uint32_t solve_bonus;
+    };
+    std::vector<Board> boards;
+    boards.reserve(states.size());
+    for (std::size_t i = 0; i < states.size(); i++) {
+        const State &state = *states[i];
+        if (state.mNSolutions == 0) continue;
+        boards.push_back(Board{ state, keyboards[i], EntropyScale(state.mNSolutions), LetterCounts(packed_words, state.mWords),
+                                static_cast<uint32_t>(JOINT_SOLVE_BONUS / state.mNSolutions) });
+    }
+    auto solve_bonus_of = [&boards](uint16_t guess) {
+        uint32_t bonus = 0;
+        for (auto &board : boards) {
+            if (guess < N_SOLUTIONS && board.state.mSolutionSet.test(guess)) bonus += board.solve_bonus;
+        }
+        return bonus;
+    };
+
+    // guesses by decreasing upper bound of their worth, skipped once they can't match the best
+    const std::size_t n_words = any.mAllWords.size();
+    std::vector<uint32_t> bound(n_words);
+    for (std::size_t id = 0; id < n_words; id++) {
+        bound[id] = solve_bonus_of(id);
+        for (auto &board : boards) {
+            bound[id] += board.letter_counts.entropy_bound(packed_words[id]);
+        }
+    }
+    std::vector<uint16_t> order(n_words);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&bound](uint16_t lhs, uint16_t rhs) { return bound[lhs] > bound[rhs]; });
+
+    // each guess's match row is shared by all the boards
+    std::atomic<uint32_t> best_worth(0);
+    std::vector<uint32_t> worth(n_words, 0);
+    any.mPool.parallel_for(0, n_words, 64, [&any, &boards, &order, &bound, &worth, &best_worth, &solve_bonus_of](std::size_t k) {
+            uint16_t guess = order[k];
+            uint32_t best = best_worth.load(std::memory_order_relaxed);
+            if (bound[guess] < best) {
+                return;
+            }
 
-    sz = mEntropy.size();
-    os.write(reinterpret_cast<char *>(&sz), sizeof sz);
+            const uint8_t *matches = any.mMatchTable.row(guess);
+            uint32_t w = solve_bonus_of(guess);
+            for (auto &board : boards) {
+                w += board.scale.entropy(sum_c_log_c(matches, board.state.mWords));
+            }
+            worth[guess] = w;
+            while (w > best && !best_worth.compare_exchange_weak(best, w, std::memory_order_relaxed)) { }
+        });
 
-    std::for_each(mEntropy.begin(), mEntropy.end(), [&os](const WordEntropy &e) { e.serialize(os); });
+    const uint32_t best = best_worth.load();
+    if (best == 0) {
+        return best_guesses;
+    }
+    std::vector<ScoredEntropy> scored_entropy;
+    for (std::size_t id = 0; id < n_words; id++) {
+        if (worth[id] != best) continue;
+        WordEntropy we(any.mAllWords[id], best);
+        int score = 0;
+        for (auto &board : boards) {
+            score += ScoredEntropy(we, board.keyboard).score();
+        }
+        scored_entropy.push_back(ScoredEntropy(we, score));
+    }
+    return best_scored(scored_entropy);
+}
 
+std::size_t State::serialize(std::ostream & os) const {
+    std::lock_guard<std::mutex> lk(mComputeLock); // persisted while other threads compute it
+    StateRecord record = {};
+    mSolutionSet.for_each([&record](uint16_t id) { record.solutions[id / 64] |= uint64_t(1) << (id % 64); });
+    record.max_entropy = mMaxEntropy;
+    record.n_entropy = mEntropy.size();
+    record.n_entropy2 = mFullyComputed ? mEntropy2.size() : 0;
+    record.fully_computed = mFullyComputed;
+    os.write(reinterpret_cast<const char *>(&record), sizeof record);
+
+    auto write_entry = [&os](const WordEntropy &e) {
+        StateRecord::Entry entry{ e.entropy(), e.word().id(), 0 };
+        os.write(reinterpret_cast<const char *>(&entry), sizeof entry);
+    };
+    std::for_each(mEntropy.begin(), mEntropy.end(), write_entry);
     if (mFullyComputed) {
-        sz = mEntropy2.size();
-        os.write(reinterpret_cast<char *>(&sz), sizeof sz);
-
-        std::for_each(mEntropy2.begin(), mEntropy2.end(), [&os](const WordEntropy &e) { e.serialize(os); });
+        std::for_each(mEntropy2.begin(), mEntropy2.end(), write_entry);
     }
+    return record.size();
 }
 
-State::State(const State::ptr &other, const Words &words, const std::vector<WordEntropy> &entropy, const std::vector<WordEntropy> &entropy2, bool fully_computed)
+State::State(const State::ptr &other, const WordIds &words, uint32_t max_entropy, const std::vector<WordEntropy> &entropy, const std::vector<WordEntropy> &entropy2, bool fully_computed)
     : mPool(other->mPool)
     , mStateCache(other->mStateCache)
+    , mWordList(other->mWordList)
+    , mMatchTable(other->mMatchTable)
     , mAllWords(other->mAllWords)
     , mWords(words)
-    , mNSolutions(std::transform_reduce(mWords.begin(), mWords.end(), 0, std::plus(), [](const Word &word) -> size_t { return word.is_solution() ? 1 : 0; }))
-    , mSolutions(extract_solutions(mNSolutions, mWords))
+    , mNSolutions(mWords.size())
+    , mSolutions(extract_solutions(mWords, mAllWords))
+    , mSolutionSet(solution_set_of(mWords))
+    , mFingerprint(fingerprint_of(mWords))
+    , mGuesses(other->guesses())
+    , mMaxEntropy(max_entropy)
     , mEntropy(entropy)
     , mEntropy2(entropy2)
     , mFullyComputed(fully_computed) {
 
-    mMaxEntropy = std::transform_reduce(mEntropy.begin(), mEntropy.end(), 0, [](uint32_t max_h, uint32_t h) { return std::max(h, max_h); },
-                                                                             [](const WordEntropy &e) -> uint32_t { return e.entropy(); });
-
     if (mFullyComputed) {
         mHighestEntropy2End = mEntropy2.begin();
         while (mHighestEntropy2End != mEntropy2.end() && mEntropy2.front().entropy() == mHighestEntropy2End->entropy()) {
@@ -401,7 +964,45 @@ State::State(const State::ptr &other, const Words &words, const std::vector<Word
     }
 }
 
+State::ptr State::unserialize(const StateRecord &record, const State::ptr &initial) {
+    const Words &all_words = initial->mAllWords;
+
+    WordIds words;
+    SolutionSet(record.solutions).for_each([&words](uint16_t id) { words.push_back(id); });
+    if (!words.empty() && words.back() >= initial->mNSolutions) {
+        throw std::runtime_error("invalid solution in state record");
+    }
+
+    const StateRecord::Entry *entries = record.entries();
+    auto read_entries = [&all_words](const StateRecord::Entry *begin, const StateRecord::Entry *end) {
+        std::vector<WordEntropy> the_entropy;
+        the_entropy.reserve(end - begin);
+        for (auto entry = begin; entry != end; entry++) {
+            if (entry->word >= all_words.size()) {
+                throw std::runtime_error("invalid word in state record");
+            }
+            the_entropy.push_back(WordEntropy(all_words[entry->word], entry->entropy));
+        }
+        return the_entropy;
+    };
+
+    return State::ptr(new State(initial, words, record.max_entropy,
+                                read_entries(entries, entries + record.n_entropy),
+                                read_entries(entries + record.n_entropy, entries + record.n_entropy + record.n_entropy2),
+                                record.fully_computed));
+}
+
+// the format predating StateRecord, kept to convert existing caches
 State::ptr State::unserialize(std::istream &is, const StateCache::ptr &cache) {
+    // words are persisted as strings; map them back onto the word list so they carry their ids
+    const Wordlist &word_list = cache->initial_state()->mWordList;
+    auto canonical = [&word_list](const Word &w) -> const Word & {
+        const Word *c = word_list.find(w.word());
+        if (!c) {
+            throw std::runtime_error("unknown word");
+        }
+        return *c;
+    };
 
     char fully_computed_c;
     is.get(fully_computed_c);
@@ -410,11 +1011,14 @@ State::ptr State::unserialize(std::istream &is, const StateCache::ptr &cache) {
     uint32_t n_words = 0;
     is.read(reinterpret_cast<char *>(&n_words), sizeof n_words);
 
-    Words words;
+    WordIds words;
     words.reserve(n_words);
     for (size_t i = 0; i < n_words; i++) {
-        words.push_back(Word::unserialize(is));
+        const Word &word = canonical(Word::unserialize(is));
+        if (!word.is_solution()) continue; // from files that still tracked all consistent words
+        words.push_back(word.id());
     }
+    std::sort(words.begin(), words.end());
 
     uint32_t n_entropy;
     is.read(reinterpret_cast<char *>(&n_entropy), sizeof n_entropy);
@@ -422,7 +1026,7 @@ State::ptr State::unserialize(std::istream &is, const StateCache::ptr &cache) {
     std::vector<WordEntropy> entropy;
     entropy.reserve(n_entropy);
     for (size_t i = 0; i < n_entropy; i++) {
-        WordEntropy e = WordEntropy::unserialize(is);
+        WordEntropy e = WordEntropy::unserialize(is, canonical);
         if (e.entropy() == 0) continue;
         entropy.push_back(e);
     }
@@ -434,11 +1038,14 @@ State::ptr State::unserialize(std::istream &is, const StateCache::ptr &cache) {
 
         entropy2.reserve(n_entropy2);
         for (size_t i = 0; i < n_entropy2; i++) {
-            WordEntropy e = WordEntropy::unserialize(is);
+            WordEntropy e = WordEntropy::unserialize(is, canonical);
             if (e.entropy() == 0) continue;
             entropy2.push_back(e);
         }
     }
 
-    return State::ptr(new State(cache->initial_state(), words, entropy, entropy2, fully_computed));
+    uint32_t max_entropy = std::transform_reduce(entropy.begin(), entropy.end(), 0, [](uint32_t max_h, uint32_t h) { return std::max(h, max_h); },
+                                                                                    [](const WordEntropy &e) -> uint32_t { return e.entropy(); });
+
+    return State::ptr(new State(cache->initial_state(), words, max_entropy, entropy, entropy2, fully_computed));
 }
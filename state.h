@@ -2,78 +2,122 @@
 // See LICENSE for details of BSD 3-Clause License
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 
+#include "solutionset.h"
+#include "statecache.h"
 #include "word.h"
 
 class Keyboard;
+class MatchTable;
 class StateCache;
 class ThreadPool;
+class Wordlist;
 
 class State {
 public:
     typedef std::shared_ptr<State> ptr;
+    // the solutions of a State bucketed by their match (index) against one guess
+    typedef std::vector<WordIds> Partition;
 
-    State(ThreadPool &pool, const std::shared_ptr<StateCache> &state_cache, const Words &all_words);
+    State(ThreadPool &pool, const std::shared_ptr<StateCache> &state_cache, const Wordlist &word_list, const MatchTable &match_table);
     ptr consider_guess(const std::string &guess, uint32_t match, bool do_full_compute = true) const;
+    ptr consider_guess(const Partition &partition, uint32_t match, bool do_full_compute = true) const;
+    std::shared_ptr<const Partition> partition(const std::string &guess) const;
+    static ptr unserialize(const StateRecord &record, const ptr &initial);
     static ptr unserialize(std::istream &is, const std::shared_ptr<StateCache> &cache);
 
-    inline std::size_t n_words() const { return mWords.size(); }
-    inline const Words &words() const { return mWords; }
-    inline const Words *words_ptr() const { return &mWords; }
+    inline const WordIds &solution_ids() const { return mWords; }
+    inline const SolutionSet &solution_set() const { return mSolutionSet; }
+    inline StateKey key() const { return StateKey{ mFingerprint, &mSolutionSet }; }
+    inline const Word &word(uint16_t id) const { return mAllWords[id]; }
+    inline const Wordlist &word_list() const { return mWordList; }
     inline std::size_t n_solutions() const { return mNSolutions; }
     inline const Words &solutions() const { return mSolutions; }
-    inline std::size_t n_entropies() const { return mEntropy.size(); }
+    std::size_t n_entropies() const;
 
     uint32_t max_entropy() const;
-    inline bool is_fully_computed() const { return mFullyComputed; }
+    bool is_fully_computed() const;
 
     uint32_t entropy_of(const std::string &word) const;
     uint32_t entropy2_of(const std::string &word) const;
-    bool words_equal_to(const Words &other_words) const;
-
-    Words filtered_words_for_guess(const std::string &guess, uint32_t match) const;
-    inline std::vector<WordEntropy> solution_entropies() const {
-        std::vector<WordEntropy> the_entropies;
-        for (auto word : mSolutions) {
-            auto it = std::find_if(mEntropy2.begin(), mEntropy2.end(), [word](const WordEntropy &e) { return e.word().word() == word.word(); });
-            if (it == mEntropy2.end()) {
-                the_entropies.push_back(WordEntropy(word, 0));
-            }
-            else {
-                the_entropies.push_back(*it);
-            }
-        }
-        return the_entropies;
-    }
+    bool solutions_equal_to(const SolutionSet &other_solutions) const;
+
+    WordIds filtered_words_for_guess(const std::string &guess, uint32_t match) const;
+    std::vector<WordEntropy> solution_entropies() const;
     std::vector<ScoredEntropy> best_guess(const Keyboard &keyboard) const;
+    // the best guess to play on all of states at once, as on the boards of a Quordle or Octordle,
+    // each with its keyboard: the most entropy summed over the boards, with a bonus for solving one
+    static std::vector<ScoredEntropy> joint_best_guess(const std::vector<ptr> &states, const std::vector<Keyboard> &keyboards);
 
-    void serialize(std::ostream &os) const;
+    // the size written, as the state may get computed further between two calls
+    std::size_t serialize(std::ostream &os) const;
 
 private:
-    State(const State &other, const Words &filtered_words, bool do_full_compute = true);
-    State(const ptr &other, const Words &words, const std::vector<WordEntropy> &entropy, const std::vector<WordEntropy> &entropy2, bool fully_computed);
-
-    uint32_t compute_entropy_of(const std::string &word) const;
-    uint32_t compute_entropy2_of(const std::string &word) const;
-
-    void compute_entropy2() const;
+    State(const State &other, const WordIds &filtered_solutions, bool do_full_compute = true);
+    State(const ptr &other, const WordIds &words, uint32_t max_entropy, const std::vector<WordEntropy> &entropy, const std::vector<WordEntropy> &entropy2, bool fully_computed);
+
+    Word resolve(const std::string &guess) const;
+    ptr consider_guess(const Word &guess, uint32_t match, bool do_full_compute) const;
+    ptr consider_solutions(const WordIds &filtered_solutions, bool do_full_compute) const;
+    std::vector<uint8_t> match_values(const Word &guess) const;
+    std::shared_ptr<const Partition> partition(const Word &guess) const;
+    WordIds filtered_words_for_guess(const Word &guess, uint32_t match) const;
+
+    uint32_t absent_letters() const;
+    uint32_t compute_entropy_of(const Word &word) const;
+    uint32_t compute_max_entropy() const;
+    uint32_t compute_entropy2_of(const WordEntropy &we, const Partition &partition, uint32_t threshold = 0) const;
+    uint32_t entropy2_bound_of(const Word &word, uint32_t entropy) const;
+
+    // what compute_entropy() and compute_entropy2() find, computed off mComputeLock (they wait on the
+    // pool) and installed under it at once: the first of the threads sharing the state to finish wins
+    struct Computed {
+        uint32_t max_entropy = 0;
+        std::vector<WordEntropy> entropy;
+        std::shared_ptr<const WordIds> guesses;
+        std::vector<WordEntropy> entropy2;
+        std::vector<std::pair<uint16_t, std::shared_ptr<const Partition>>> partitions;
+    };
+    void compute_entropy(Computed &computed) const;
+    void compute_entropy2(Computed &computed) const;
+    void compute_fully() const;
+    void install(Computed &computed) const;
 
     ThreadPool &mPool;
     std::shared_ptr<StateCache> mStateCache;
 
+    const Wordlist &mWordList;
+    const MatchTable &mMatchTable;
     const Words &mAllWords;
-    const Words mWords;
+    const WordIds mWords;          // the remaining solutions; what identifies the state
     const size_t mNSolutions;
     const Words mSolutions;        // populated only if size will be less than MAX_N_SOLUTIONS_PRINTED
-
-    mutable uint32_t mMaxEntropy;
+    const SolutionSet mSolutionSet;
+    const uint64_t mFingerprint;
+    // the words worth guessing: the parent state's, less the ones that couldn't tell its solutions apart
+    std::shared_ptr<const WordIds> guesses() const;
+    mutable std::shared_ptr<const WordIds> mGuesses;
+
+    // the lazily computed fields below are only accessed under mComputeLock, but for mMaxEntropy
+    // (read by the parent states computing their entropy2), and mEntropy2 once fully computed
+    mutable std::atomic<uint32_t> mMaxEntropy;
     mutable std::vector<WordEntropy> mEntropy;
     mutable std::vector<WordEntropy> mEntropy2;
     mutable std::vector<WordEntropy>::const_iterator mHighestEntropy2End;
     mutable bool mFullyComputed;
+    mutable std::optional<WordIds> mEndgameGuesses; // the best guesses, when few enough solutions to play exactly
+    mutable std::mutex mComputeLock;
+
+    // partitions for the top entropy2 guesses, so that considering one of them is a lookup
+    mutable std::mutex mPartitionsLock;
+    mutable std::unordered_map<uint16_t, std::shared_ptr<const Partition>> mPartitions;
 };
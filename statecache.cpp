@@ -1,28 +1,161 @@
 // Copyright (c) 2022, Bertrand Mollinier Toublet
 // See LICENSE for details of BSD 3-Clause License
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <numeric>
 #include <sstream>
 #include <mutex>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "state.h"
 #include "statecache.h"
+#include "wordlist.h"
+
+namespace {
+
+const char *kStateCacheFileName = "wordle_state_cache.bin";
+const char *kStateCacheTempFileName = "wordle_state_cache.bin.tmp";
+const char *kJournalFileName = "wordle_state_cache.journal";
+const char *kJournalTempFileName = "wordle_state_cache.journal.tmp";
+
+const char kMagic[8] = { 'W', 'O', 'R', 'D', 'L', 'E', 'S', 'C' };
+const char kJournalMagic[8] = { 'W', 'O', 'R', 'D', 'L', 'E', 'S', 'J' };
+const uint32_t kVersion = 1;
+
+// file layout: header, index (n_records entries sorted by fingerprint), records
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_records;
+    uint64_t word_list_signature;
+};
+
+// journal layout: header, then records appended as states are persisted; a state may appear more
+// than once, the last record wins
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t word_list_signature;
+};
+
+const char kPadding[8] = {};
+
+inline std::size_t aligned(std::size_t sz) {
+    return (sz + 7) & ~std::size_t(7);
+}
 
-bool StateCache::contains(const Words *key) const {
-    std::shared_lock sl(mMutex);
+} // namespace
+
+StateCache::~StateCache() {
+    wait_for_compaction();
+    unmap_file();
+}
+
+bool StateCache::map_file(const char *file_name) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const FileHeader *header = static_cast<const FileHeader *>(mapped);
+    if (st.st_size < static_cast<off_t>(sizeof(FileHeader) + header->n_records * sizeof(IndexEntry))) {
+        munmap(mapped, st.st_size);
+        return false;
+    }
 
-    return mCache.contains(key);
+    unmap_file();
+    mMapped = static_cast<const char *>(mapped);
+    mMappedSize = st.st_size;
+    mIndex = reinterpret_cast<const IndexEntry *>(mMapped + sizeof(FileHeader));
+    mNIndexed = header->n_records;
+
+    return true;
 }
 
-State::ptr StateCache::at(const Words *key) const {
+void StateCache::unmap_file() {
+    if (mMapped) {
+        munmap(const_cast<char *>(mMapped), mMappedSize);
+    }
+    mMapped = nullptr;
+    mMappedSize = 0;
+    mIndex = nullptr;
+    mNIndexed = 0;
+}
+
+const StateRecord *StateCache::find_record(const StateKey &key) const {
+    auto range = std::equal_range(mIndex, mIndex + mNIndexed, IndexEntry{ key.fingerprint, 0 },
+                                  [](const IndexEntry &lhs, const IndexEntry &rhs) { return lhs.fingerprint < rhs.fingerprint; });
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->offset + sizeof(StateRecord) > mMappedSize) {
+            throw std::runtime_error("corrupted state cache index");
+        }
+        const StateRecord *record = reinterpret_cast<const StateRecord *>(mMapped + it->offset);
+        if (SolutionSet(record->solutions) == *key.solutions) {
+            return record;
+        }
+    }
+    return nullptr;
+}
+
+bool StateCache::contains(const StateKey &key) const {
     std::shared_lock sl(mMutex);
 
-    auto s = mCache.at(key);
+    return mCache.contains(key) || find_record(key) != nullptr;
+}
+
+State::ptr StateCache::find(const StateKey &key) {
+    State::ptr s;
+    {
+        std::shared_lock sl(mMutex);
+
+        auto it = mCache.find(key);
+        if (it != mCache.end()) {
+            mTotalHits++;
+            mHitsSinceLastReport++;
+            return it->second;
+        }
+
+        const StateRecord *record = find_record(key);
+        if (!record) {
+            return nullptr;
+        }
+        if (reinterpret_cast<const char *>(record) + record->size() > mMapped + mMappedSize) {
+            throw std::runtime_error("corrupted state cache record");
+        }
+        s = State::unserialize(*record, mInitialState);
+    }
+
+    // first touch of a persisted state: keep it decoded (or whatever a concurrent decode kept)
+    std::unique_lock ul(mMutex);
+    auto it = mCache.insert(std::make_pair(s->key(), s));
     mTotalHits++;
     mHitsSinceLastReport++;
+    return it.first->second;
+}
+
+State::ptr StateCache::at(const StateKey &key) {
+    auto s = find(key);
+    if (!s) {
+        throw std::out_of_range("StateCache::at");
+    }
     return s;
 }
 
@@ -32,18 +165,19 @@ std::pair<StateCache::iterator, bool> StateCache::insert(State::ptr value) {
     mTotalMisses++;
     mMissesSinceLastReport++;
 
-    auto key = value->words_ptr();
+    auto key = value->key();
     auto it = mCache.insert(std::make_pair(key, value));
     if (!it.second) {
-        assert(it.first->second->words_equal_to(*key));
+        assert(it.first->second->solutions_equal_to(*key.solutions));
 #if DEBUG_STATE_CACHE
-        std::cout << "FAILED to insert state with filtered words: " << std::endl;
-        std::for_each(key->begin(), key->end(), [](const Word &w) { std::cout << "\"" << w.word() << "\", "; });
+        std::cout << "FAILED to insert state with filtered solutions: " << std::endl;
+        key.solutions->for_each([&value](uint16_t id) { std::cout << "\"" << value->word(id).word() << "\", "; });
         std::cout << std::endl
                   << "It was probably inserted concurrently; continuing" << std::endl;
 #endif // DEBUG_STATE_CACHE
     }
     else {
+        mPending.push_back(value);
         mDirty = true;
 
         if (!mInitialState.get()) {
@@ -64,7 +198,7 @@ std::string StateCache::report() {
     std::size_t total_entropy_entries = std::transform_reduce(mCache.begin(), mCache.end(), 0, std::plus<>(), [](auto &entry) -> std::size_t { return entry.second->n_entropies(); });
 
     std::stringstream ss;
-    ss << "E:" << mCache.size() << "(F:" << n_fully_computed << ")(avg " << (total_entropy_entries * 1.) / mCache.size() << " h/s)" << std::endl
+    ss << "E:" << mCache.size() << "(F:" << n_fully_computed << ")(avg " << (total_entropy_entries * 1.) / mCache.size() << " h/s)|D:" << mNIndexed << std::endl
        << "T:H:" << mTotalHits           << "|M:" << mTotalMisses           << "|I:" << mTotalInserts           << " / " << total_events << std::endl
        << "S:H:" << mHitsSinceLastReport << "|M:" << mMissesSinceLastReport << "|I:" << mInsertsSinceLastReport << " / " << events_since_last_report;
 
@@ -75,33 +209,249 @@ std::string StateCache::report() {
     return ss.str();
 }
 
-void StateCache::serialize(std::ostream &os) const {
-    assert(mCache.size() <= std::numeric_limits<uint32_t>::max());
-    uint32_t sz = mCache.size() - 1;
-    os.write(reinterpret_cast<char *>(&sz), sizeof sz);
+void StateCache::make_dirty(const State &state) {
+    std::unique_lock ul(mMutex);
 
-    std::for_each(mCache.begin(), mCache.end(), [&os, this](const auto &cache_entry) {
-            if (cache_entry.second == mInitialState) { // skip initial state
-                return;
-            }
-            cache_entry.second->serialize(os);
-        });
+    auto key = state.key();
+    mUpdated.push_back(std::make_pair(key.fingerprint, *key.solutions));
+    mDirty = true;
+}
 
-    mDirty = false;
+StateCache::Snapshot StateCache::snapshot() const {
+    Snapshot the_snapshot;
+    the_snapshot.mapped = mMapped;
+    the_snapshot.mapped_index = mIndex;
+    the_snapshot.n_mapped = mNIndexed;
+    the_snapshot.signature = mInitialState->word_list().signature();
+
+    // only the states: encoding them is left to write(), off the lock
+    the_snapshot.states.reserve(mCache.size());
+    for (const auto &cache_entry : mCache) {
+        if (cache_entry.second != mInitialState) { // skip initial state
+            the_snapshot.states.push_back(cache_entry.second);
+        }
+    }
+    return the_snapshot;
 }
 
-void StateCache::persist() const {
-    if (!mDirty) return;
+void StateCache::write(std::ostream &os, const Snapshot &snapshot) {
+    // states in memory supersede their persisted record (they may have been computed further);
+    // records never touched are carried over as they are
+    std::ostringstream states;
+    std::vector<IndexEntry> state_index;
+    std::unordered_set<StateKey> in_memory;
+    for (const auto &state : snapshot.states) {
+        state_index.push_back(IndexEntry{ state->key().fingerprint, static_cast<uint64_t>(states.tellp()) });
+        std::size_t sz = state->serialize(states);
+        states.write(kPadding, aligned(sz) - sz);
+        in_memory.insert(state->key());
+    }
+    std::vector<IndexEntry> records;
+    for (std::size_t i = 0; i < snapshot.n_mapped; i++) {
+        SolutionSet solutions(reinterpret_cast<const StateRecord *>(snapshot.mapped + snapshot.mapped_index[i].offset)->solutions);
+        if (!in_memory.contains(StateKey{ snapshot.mapped_index[i].fingerprint, &solutions })) {
+            records.push_back(snapshot.mapped_index[i]);
+        }
+    }
+    const std::string encoded = states.str();
+
+    std::size_t n_records = state_index.size() + records.size();
+    std::size_t offset = sizeof(FileHeader) + n_records * sizeof(IndexEntry);
+    std::vector<IndexEntry> index;
+    index.reserve(n_records);
+    for (auto &entry : state_index) {
+        index.push_back(IndexEntry{ entry.fingerprint, offset + entry.offset });
+    }
+    offset += encoded.size();
+    for (auto &entry : records) {
+        index.push_back(IndexEntry{ entry.fingerprint, offset });
+        offset += aligned(reinterpret_cast<const StateRecord *>(snapshot.mapped + entry.offset)->size());
+    }
+    std::stable_sort(index.begin(), index.end(), [](const IndexEntry &lhs, const IndexEntry &rhs) { return lhs.fingerprint < rhs.fingerprint; });
+
+    assert(index.size() <= std::numeric_limits<uint32_t>::max());
+    FileHeader header;
+    std::memcpy(header.magic, kMagic, sizeof header.magic);
+    header.version = kVersion;
+    header.n_records = index.size();
+    header.word_list_signature = snapshot.signature;
+
+    os.write(reinterpret_cast<const char *>(&header), sizeof header);
+    os.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(IndexEntry));
+    os.write(encoded.data(), encoded.size());
+    for (auto &entry : records) {
+        const StateRecord *record = reinterpret_cast<const StateRecord *>(snapshot.mapped + entry.offset);
+        std::size_t sz = record->size();
+        os.write(reinterpret_cast<const char *>(record), sz);
+        os.write(kPadding, aligned(sz) - sz);
+    }
+}
 
-    std::cout << "Persisting state cache..." << std::flush;
+bool StateCache::append_journal(const std::vector<State::ptr> &states) {
+    if (states.empty()) return true;
 
     std::ofstream ofs;
-    ofs.open("wordle_state_cache.bin", std::ofstream::trunc|std::ofstream::binary);
+    if (mJournalSize == 0) {
+        ofs.open(kJournalFileName, std::ofstream::trunc|std::ofstream::binary);
+
+        JournalHeader header;
+        std::memcpy(header.magic, kJournalMagic, sizeof header.magic);
+        header.version = kVersion;
+        header.reserved = 0;
+        header.word_list_signature = mInitialState->word_list().signature();
+        ofs.write(reinterpret_cast<const char *>(&header), sizeof header);
+        mJournalSize = sizeof header;
+    }
+    else {
+        ofs.open(kJournalFileName, std::ofstream::app|std::ofstream::binary);
+    }
+
+    for (auto &state : states) {
+        std::size_t sz = state->serialize(ofs);
+        ofs.write(kPadding, aligned(sz) - sz);
+        mJournalSize += aligned(sz);
+    }
+
+    ofs.close();
+    return !ofs.fail();
+}
+
+std::size_t StateCache::replay_journal() {
+    std::ifstream ifs;
+    ifs.open(kJournalFileName, std::ifstream::binary);
+    if (ifs.fail()) return 0;
+
+    JournalHeader header;
+    ifs.read(reinterpret_cast<char *>(&header), sizeof header);
+    if (!ifs.good() || std::memcmp(header.magic, kJournalMagic, sizeof header.magic) != 0
+        || header.version != kVersion || header.word_list_signature != mInitialState->word_list().signature()) {
+        return 0; // left to be overwritten
+    }
+
+    std::vector<State::ptr> replayed;
+    std::size_t journal_size = sizeof header;
+    std::size_t max_entries = 2 * mInitialState->word_list().all_words().size();
+    std::vector<uint64_t> buffer(sizeof(StateRecord) / sizeof(uint64_t));
+    while (ifs.read(reinterpret_cast<char *>(buffer.data()), sizeof(StateRecord))) {
+        const StateRecord *record = reinterpret_cast<const StateRecord *>(buffer.data());
+        if (record->n_entropy + record->n_entropy2 > max_entries) break;
+
+        std::size_t sz = aligned(record->size());
+        buffer.resize(sz / sizeof(uint64_t));
+        if (!ifs.read(reinterpret_cast<char *>(buffer.data()) + sizeof(StateRecord), sz - sizeof(StateRecord))) break;
+
+        State::ptr state = State::unserialize(*reinterpret_cast<const StateRecord *>(buffer.data()), mInitialState);
+        auto it = mCache.find(state->key());
+        if (it != mCache.end()) {
+            mCache.erase(it); // the key points into the state it replaces
+        }
+        mCache.insert(std::make_pair(state->key(), state));
+        replayed.push_back(state);
+        journal_size += sz;
+    }
+    ifs.close();
 
-    serialize(ofs);
+    // drop whatever was torn off the end, so that appending resumes after the last full record.
+    // Failing that, the journal is rewritten from scratch on the next persist, with them all.
+    if (truncate(kJournalFileName, journal_size) != 0) {
+        mPending.insert(mPending.end(), replayed.begin(), replayed.end());
+        return replayed.size();
+    }
+    mJournalSize = journal_size;
 
+    return replayed.size();
+}
+
+void StateCache::compact(Snapshot snapshot, std::size_t journal_size) {
+    std::ofstream ofs;
+    ofs.open(kStateCacheTempFileName, std::ofstream::trunc|std::ofstream::binary);
+    write(ofs, snapshot);
     ofs.close();
-    std::cout << " done" << std::endl;
+
+    std::unique_lock ul(mMutex);
+
+    if (!ofs.fail() && std::rename(kStateCacheTempFileName, kStateCacheFileName) == 0) {
+        unmap_file();
+        map_file(kStateCacheFileName);
+
+        // the base now holds everything journaled up to the snapshot; keep what came after it
+        if (mJournalSize == journal_size) {
+            std::remove(kJournalFileName);
+            mJournalSize = 0;
+        }
+        else {
+            std::string journal(mJournalSize, '\0');
+            std::ifstream ifs;
+            ifs.open(kJournalFileName, std::ifstream::binary);
+            ifs.read(journal.data(), journal.size());
+            ifs.close();
+
+            std::ofstream jofs;
+            jofs.open(kJournalTempFileName, std::ofstream::trunc|std::ofstream::binary);
+            jofs.write(journal.data(), sizeof(JournalHeader));
+            jofs.write(journal.data() + journal_size, journal.size() - journal_size);
+            jofs.close();
+
+            if (!ifs.fail() && !jofs.fail() && std::rename(kJournalTempFileName, kJournalFileName) == 0) {
+                mJournalSize = sizeof(JournalHeader) + journal.size() - journal_size;
+            }
+        }
+#if DEBUG_STATE_CACHE
+        std::cout << "Compacted state cache: " << mNIndexed << " states" << std::endl;
+#endif // DEBUG_STATE_CACHE
+    }
+
+    mCompacting = false;
+}
+
+void StateCache::persist() {
+    std::unique_lock ul(mMutex);
+
+    if (!mDirty) return;
+
+    mLog << "Persisting state cache..." << std::flush;
+
+    // journal the states inserted since, and those fully computed since they were journaled
+    std::vector<State::ptr> states;
+    std::unordered_set<const State *> seen;
+    auto add = [this, &states, &seen](const State::ptr &state) {
+        if (state != mInitialState && seen.insert(state.get()).second) {
+            states.push_back(state);
+        }
+    };
+    std::for_each(mPending.begin(), mPending.end(), add);
+    for (auto &updated : mUpdated) {
+        auto it = mCache.find(StateKey{ updated.first, &updated.second });
+        if (it != mCache.end()) {
+            add(it->second);
+        }
+    }
+
+    if (!append_journal(states)) {
+        mLog << " failed" << std::endl;
+        return;
+    }
+    mPending.clear();
+    mUpdated.clear();
+    mDirty = false;
+
+    mLog << " done" << std::endl;
+
+    // fold the journal into the base file once it has grown large enough, encoding the states on
+    // the compaction thread: only their pointers are taken under the lock
+    if (!mCompacting && mJournalSize > std::max<double>(JOURNAL_COMPACTION_RATIO * mMappedSize, JOURNAL_COMPACTION_MIN_SIZE)) {
+        if (mCompaction.joinable()) {
+            mCompaction.join();
+        }
+        mCompacting = true;
+        mCompaction = std::thread(&StateCache::compact, this, snapshot(), mJournalSize);
+    }
+}
+
+void StateCache::wait_for_compaction() {
+    if (mCompaction.joinable()) {
+        mCompaction.join();
+    }
 }
 
 StateCache::ptr StateCache::unserialize(StateCache::ptr &init, std::istream &is) {
@@ -111,7 +461,11 @@ StateCache::ptr StateCache::unserialize(StateCache::ptr &init, std::istream &is)
     for (size_t i = 0; i < n_states; i++) {
         State::ptr state = State::unserialize(is, init);
         auto p = init->insert(state);
-        assert(p.second);
+        if (!p.second && state->is_fully_computed() && !p.first->second->is_fully_computed()) {
+            // older files told apart states with the same solutions: keep the most computed one
+            init->mCache.erase(p.first);
+            init->mCache.insert(std::make_pair(state->key(), state));
+        }
     }
 
     init->mDirty = false;
@@ -120,20 +474,56 @@ StateCache::ptr StateCache::unserialize(StateCache::ptr &init, std::istream &is)
 }
 
 StateCache::ptr StateCache::restore(StateCache::ptr &init) {
-    std::cout << "Loading state cache..." << std::flush;
+    init->mLog << "Loading state cache..." << std::flush;
+
+    bool loaded = false;
+    bool converted = false;
 
     std::ifstream ifs;
-    ifs.open("wordle_state_cache.bin", std::ifstream::binary);
-    if (ifs.fail()) {
-        std::cout << " failed: initializing from scratch" << std::endl;
+    ifs.open(kStateCacheFileName, std::ifstream::binary);
+    if (ifs.is_open()) {
+        FileHeader header;
+        ifs.read(reinterpret_cast<char *>(&header), sizeof header);
+        if (ifs.good() && std::memcmp(header.magic, kMagic, sizeof header.magic) == 0) {
+            ifs.close();
+
+            if (header.version != kVersion || header.word_list_signature != init->initial_state()->word_list().signature()) {
+                init->mLog << " failed: stale cache, initializing from scratch" << std::endl;
+                return init;
+            }
+            loaded = init->map_file(kStateCacheFileName);
+        }
+        else {
+            // previous, stream format: load it all, and have it rewritten in the indexed format
+            ifs.clear();
+            ifs.seekg(0);
+            auto c = StateCache::unserialize(init, ifs);
+            assert(c == init);
+
+            ifs.close();
+            loaded = converted = true;
+        }
+    }
+
+    // states that came from the journal are already in it, unless it has to be rewritten;
+    // converted ones are all to be persisted
+    init->mPending.clear();
+    init->mUpdated.clear();
+    std::size_t n_replayed = init->replay_journal();
+    if (!loaded && n_replayed == 0) {
+        init->mLog << " failed: initializing from scratch" << std::endl;
         return init;
     }
 
-    auto c = StateCache::unserialize(init, ifs);
-    assert(c == init);
+    if (converted) {
+        std::for_each(init->mCache.begin(), init->mCache.end(), [&init](const auto &cache_entry) { init->mPending.push_back(cache_entry.second); });
+    }
+    init->mDirty = !init->mPending.empty();
 
-    ifs.close();
-    std::cout << " done" << std::endl;
+    init->mLog << " done";
+    if (converted) init->mLog << " (converted from previous format)";
+    if (n_replayed > 0) init->mLog << " (replayed " << n_replayed << " journaled states)";
+    init->mLog << std::endl;
 
     init->reset_stats();
 #if DEBUG_STATE_CACHE
@@ -3,53 +3,105 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <iostream>
 #include <memory>
 #include <shared_mutex>
-#include <sstream>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+
+#include "solutionset.h"
+#include "word.h"
 
 class State;
 
+// Zobrist-style fingerprint: the xor of a fixed pseudo-random key per word, so that it can be
+// accumulated word by word as a State's solutions are filtered
+inline uint64_t word_fingerprint(uint16_t id) {
+    uint64_t z = (id + 1) * 0x9e3779b97f4a7c15ull; // splitmix64
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t fingerprint_of(const WordIds &words) {
+    uint64_t fingerprint = 0;
+    for (auto id : words) fingerprint ^= word_fingerprint(id);
+    return fingerprint;
+}
+
+// identifies a State: its remaining solutions (entropy depends on nothing else), looked up by
+// their precomputed fingerprint and verified in full
+struct StateKey {
+    uint64_t fingerprint;
+    const SolutionSet *solutions;
+};
+
 template <>
-struct std::hash<const Words *> {
-    std::size_t operator()(Words const *words) const noexcept {
-        std::stringstream ss;
-        std::for_each(words->begin(), words->end(), [&ss](const Word &s) { ss << s.word(); });
-        std::string s = ss.str();
-        return std::hash<std::string>{}(s);
+struct std::hash<StateKey> {
+    std::size_t operator()(const StateKey &key) const noexcept {
+        return key.fingerprint;
     }
 };
 
 template <>
-struct std::equal_to<const Words *> {
-    bool operator()(const Words *lhs, const Words *rhs) const {
-        if (lhs->size() != rhs->size()) { return false; }
-        for (auto lit = lhs->cbegin(), rit = rhs->cbegin(); lit != lhs->end(); lit++, rit++) {
-            if (lit->word() != rit->word()) { return false; }
-        }
-        return true;
+struct std::equal_to<StateKey> {
+    bool operator()(const StateKey &lhs, const StateKey &rhs) const {
+        return lhs.fingerprint == rhs.fingerprint
+            && *lhs.solutions == *rhs.solutions;
     }
 };
 
+// On-disk layout of a State: a fixed-width header followed by fixed-width entropy entries,
+// mEntropy's then (if fully computed) mEntropy2's. Records are 8-byte aligned in the file.
+struct StateRecord {
+    struct Entry {
+        uint32_t entropy;
+        uint16_t word;
+        uint16_t reserved;
+    };
+
+    uint64_t solutions[SolutionSet::kNWords];
+    uint32_t max_entropy;
+    uint32_t n_entropy;
+    uint32_t n_entropy2;
+    uint32_t fully_computed;
+
+    inline const Entry *entries() const { return reinterpret_cast<const Entry *>(this + 1); }
+    inline std::size_t size() const { return sizeof *this + (n_entropy + n_entropy2) * sizeof(Entry); }
+};
+
 class StateCache {
 public:
     typedef std::shared_ptr<StateCache> ptr;
-    typedef std::unordered_map<const Words *, std::shared_ptr<State>> map;
+    typedef std::unordered_map<StateKey, std::shared_ptr<State>> map;
     typedef map::iterator iterator;
 
-    inline StateCache()
-        : mTotalHits(0)
+    // progress (loading, persisting) is reported to log
+    inline StateCache(std::ostream &log = std::cout)
+        : mLog(log)
+        , mMapped(nullptr)
+        , mMappedSize(0)
+        , mIndex(nullptr)
+        , mNIndexed(0)
+        , mJournalSize(0)
+        , mCompacting(false)
+        , mTotalHits(0)
         , mTotalMisses(0)
         , mTotalInserts(0)
         , mHitsSinceLastReport(0)
         , mMissesSinceLastReport(0)
         , mInsertsSinceLastReport(0)
         , mDirty(false) { }
+    ~StateCache();
     static ptr unserialize(ptr &init, std::istream &is);
     static ptr restore(ptr &init);
 
-    bool contains(const Words *key) const;
-    std::shared_ptr<State> at(const Words *key) const;
+    bool contains(const StateKey &key) const;
+    std::shared_ptr<State> find(const StateKey &key); // nullptr when not cached
+    std::shared_ptr<State> at(const StateKey &key);
     std::pair<iterator, bool> insert(std::shared_ptr<State> value);
 
     std::shared_ptr<State> initial_state() const { return mInitialState; }
@@ -63,27 +115,65 @@ public:
         mInsertsSinceLastReport = 0;
     }
     std::string report();
+    inline std::size_t n_hits() const { return mTotalHits; }
+    inline std::size_t n_misses() const { return mTotalMisses; }
 
-    void persist() const;
-    void serialize(std::ostream &os) const;
+    void persist();
+    void wait_for_compaction();
 
-    inline void make_dirty() { mDirty = true; }
+    void make_dirty(const State &state);
     inline bool dirty() const { return mDirty; }
 
 private:
-    inline void set_cache(const map &cache) {
-        mCache = cache;
-    }
-
-    map mCache;
+    struct IndexEntry {
+        uint64_t fingerprint;
+        uint64_t offset;
+    };
+
+    // what goes into the base file: the states in memory, and the mapped records none of them
+    // supersedes, copied as they are when the snapshot is written
+    struct Snapshot {
+        std::vector<std::shared_ptr<State>> states;
+        const char *mapped;
+        const IndexEntry *mapped_index;
+        std::size_t n_mapped;
+        uint64_t signature;
+    };
+
+    bool map_file(const char *file_name);
+    void unmap_file();
+    const StateRecord *find_record(const StateKey &key) const;
+
+    Snapshot snapshot() const;
+    static void write(std::ostream &os, const Snapshot &snapshot);
+    void compact(Snapshot snapshot, std::size_t journal_size);
+    bool append_journal(const std::vector<std::shared_ptr<State>> &states);
+    std::size_t replay_journal();
+
+    std::ostream &mLog;
+
+    map mCache;                    // states in memory: computed, or decoded from the mapped file
     mutable std::shared_mutex mMutex;
     std::shared_ptr<State> mInitialState;
 
-    mutable std::size_t mTotalHits;
+    // the persisted cache, mapped and decoded state by state as they are asked for
+    const char *mMapped;
+    std::size_t mMappedSize;
+    const IndexEntry *mIndex;      // sorted by fingerprint
+    std::size_t mNIndexed;
+
+    // states persisted since, appended to the journal; the base file is compacted in the background
+    std::vector<std::shared_ptr<State>> mPending;              // inserted
+    std::vector<std::pair<uint64_t, SolutionSet>> mUpdated;    // fully computed after being inserted
+    std::size_t mJournalSize;
+    std::thread mCompaction;
+    bool mCompacting;
+
+    mutable std::atomic<std::size_t> mTotalHits; // counted under a shared lock
     std::size_t mTotalMisses;
     std::size_t mTotalInserts;
 
-    mutable std::size_t mHitsSinceLastReport;
+    mutable std::atomic<std::size_t> mHitsSinceLastReport;
     std::size_t mMissesSinceLastReport;
     std::size_t mInsertsSinceLastReport;
 
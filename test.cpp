@@ -1,32 +1,222 @@
 // Copyright (c) 2022, Bertrand Mollinier Toublet
 // See LICENSE for details of BSD 3-Clause License
+#include <algorithm>
+#include <bit>
 #include <functional>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <random>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "config.h"
+#include "endgame.h"
 #include "keyboard.h"
 #include "match.h"
+#include "matchtable.h"
 #include "state.h"
 #include "statecache.h"
 #include "threadpool.h"
+#include "wordle.h"
 #include "wordlist.h"
 
+namespace {
+
+void print_match(const std::string &guess, const std::string &solution) {
+    Match m(guess, solution);
+    Match n(guess, Match::packed_value(Match::pack(guess), Match::pack(solution)));
+    std::cout << m.toString() << " " << n.toString() << std::endl;
+}
+
+// The least total number of guesses to find each of solutions, by exhaustive search: for every
+// guess, one guess for each solution plus the total of each bucket it leaves but the solution's.
+class BruteForceEndgame {
+public:
+    BruteForceEndgame(const MatchTable &match_table, const WordIds &solutions, const WordIds &guesses)
+        : mMatchTable(match_table)
+        , mSolutions(solutions)
+        , mGuesses(guesses) { }
+
+    uint32_t total() {
+        return total((uint64_t(1) << mSolutions.size()) - 1);
+    }
+
+    // the same, guessing guess first; 0 if it tells none of the solutions apart
+    uint32_t total_with(uint64_t mask, uint16_t guess) {
+        std::map<uint8_t, uint64_t> buckets;
+        for (std::size_t i = 0; i < mSolutions.size(); i++) {
+            if (mask & (uint64_t(1) << i)) buckets[mMatchTable.at(guess, mSolutions[i])] |= uint64_t(1) << i;
+        }
+        if (buckets.size() == 1 && buckets.begin()->first != Match::kMaxValue) return 0;
+
+        uint32_t total = std::popcount(mask);
+        for (auto &bucket : buckets) {
+            if (bucket.first != Match::kMaxValue) total += this->total(bucket.second);
+        }
+        return total;
+    }
+
+private:
+    uint32_t total(uint64_t mask) {
+        auto it = mTotals.find(mask);
+        if (it != mTotals.end()) return it->second;
+
+        uint32_t best = std::numeric_limits<uint32_t>::max();
+        for (auto guess : mGuesses) {
+            uint32_t t = total_with(mask, guess);
+            if (t != 0) best = std::min(best, t);
+        }
+        mTotals[mask] = best;
+        return best;
+    }
+
+    const MatchTable &mMatchTable;
+    const WordIds mSolutions;
+    const WordIds mGuesses;
+    std::map<uint64_t, uint32_t> mTotals;
+};
+
+// Endgame against BruteForceEndgame, on solutions left after a random guess (up to 10, for the
+// brute force to be quick) with a random sample of guesses: the number of endgames they disagree on
+std::size_t check_endgame(const MatchTable &match_table, const Wordlist &word_list) {
+    const std::size_t kNEndgames = 200;
+    const std::size_t kMaxNSolutions = 10;
+    const std::size_t kNGuesses = 300;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<uint16_t> any_solution(0, word_list.n_solutions() - 1);
+    std::uniform_int_distribution<uint16_t> any_word(0, word_list.all_words().size() - 1);
+    std::size_t n_mismatches = 0;
+    for (std::size_t e = 0; e < kNEndgames; e++) {
+        const uint16_t guess = any_word(gen), solution = any_solution(gen);
+        WordIds solutions;
+        for (uint16_t s = 0; s < word_list.n_solutions() && solutions.size() < kMaxNSolutions; s++) {
+            if (match_table.at(guess, s) == match_table.at(guess, solution)) solutions.push_back(s);
+        }
+        WordIds guesses = solutions;
+        while (guesses.size() < solutions.size() + kNGuesses) guesses.push_back(any_word(gen));
+        std::sort(guesses.begin(), guesses.end());
+        guesses.erase(std::unique(guesses.begin(), guesses.end()), guesses.end());
+
+        Endgame endgame(match_table, solutions, guesses);
+        BruteForceEndgame brute_force(match_table, solutions, guesses);
+        const std::size_t n = solutions.size();
+        const uint32_t total = brute_force.total();
+        bool ok = static_cast<uint32_t>(endgame.expected_guesses() * n + 0.5) == total && total >= 2 * n - 1;
+
+        // and the best guesses are all those achieving it
+        const uint64_t all = (uint64_t(1) << n) - 1;
+        WordIds best_guesses;
+        for (auto g : guesses) {
+            if (brute_force.total_with(all, g) == total) best_guesses.push_back(g);
+        }
+        ok = ok && endgame.best_guesses() == best_guesses;
+
+        if (!ok) {
+            std::cout << "Endgame mismatch on " << n << " solutions after \"" << word_list.all_words()[guess].word() << "\"" << std::endl;
+            n_mismatches++;
+        }
+    }
+    return n_mismatches;
+}
+
+// a game played through libwordle's C ABI: the number of calls that didn't do as expected
+std::size_t check_libwordle() {
+    std::size_t n_failures = 0;
+    auto check = [&n_failures](bool ok, const char *what) {
+        if (!ok) {
+            std::cout << "libwordle: " << what << " failed" << std::endl;
+            n_failures++;
+        }
+    };
+
+    wordle_engine *engine = wordle_engine_create(nullptr, nullptr);
+    check(engine != nullptr, "wordle_engine_create");
+    if (!engine) return n_failures;
+    wordle_session *session = wordle_session_create(engine, 1);
+    check(session != nullptr && wordle_session_n_boards(session) == 1, "wordle_session_create");
+    check(wordle_session_create(engine, 0) == nullptr, "wordle_session_create of no board");
+    if (!session) return n_failures;
+
+    const char *bad[] = { "cpz" };
+    check(wordle_apply_guess(session, "aiery", bad) == WORDLE_EINVAL, "wordle_apply_guess of a bad match");
+    const char *matches[] = { "aacaa" };
+    check(wordle_apply_guess(session, "aiery", matches) == WORDLE_OK, "wordle_apply_guess");
+
+    const wordle_result *result = wordle_best_guess(session, 0);
+    check(result != nullptr && result->n_solutions == 64 && !result->solved && result->n_guesses > 0, "wordle_best_guess");
+    if (result && result->n_guesses > 0) {
+        const wordle_guess &best = result->guesses[0];
+        check(best.entropy == wordle_entropy_of(session, 0, best.word), "wordle_entropy_of the best guess");
+        std::cout << "libwordle: after \"aiery\", " << result->n_solutions << " solutions, best guess \"" << best.word << "\"" << std::endl;
+    }
+    check(wordle_best_guess(session, 1) == nullptr, "wordle_best_guess of a bad board");
+
+    check(wordle_back_one(session) == WORDLE_OK && wordle_back_one(session) == WORDLE_EINVAL, "wordle_back_one");
+    wordle_session_destroy(session);
+    wordle_engine_destroy(engine);
+    return n_failures;
+}
+
+} // namespace anonymous
+
 int main(void) {
-    std::cout << Match("clump", "perch").toString() << std::endl;
-    std::cout << Match("perch", "clump").toString() << std::endl;
-    std::cout << Match("tuner", "exits").toString() << std::endl;
-    std::cout << Match("exits", "tuner").toString() << std::endl;
-    std::cout << Match("doozy", "yahoo").toString() << std::endl;
-    std::cout << Match("preen", "hyper").toString() << std::endl;
-    std::cout << Match("hyper", "upper").toString() << std::endl;
-    std::cout << Match("ulama", "offal").toString() << std::endl;
-    std::cout << Match("tepee", "venom").toString() << std::endl;
-    std::cout << Match("venom", "tepee").toString() << std::endl;
+    print_match("clump", "perch");
+    print_match("perch", "clump");
+    print_match("tuner", "exits");
+    print_match("exits", "tuner");
+    print_match("doozy", "yahoo");
+    print_match("preen", "hyper");
+    print_match("hyper", "upper");
+    print_match("ulama", "offal");
+    print_match("tepee", "venom");
+    print_match("venom", "tepee");
+
+    Wordlist word_list;
+    const Words &all_words = word_list.all_words();
+    const std::vector<uint32_t> &packed_words = word_list.packed_words();
+    const std::size_t n_solutions = word_list.n_solutions();
+    std::vector<uint8_t> expected(all_words.size() * n_solutions);
+    for (auto &guess : all_words) {
+        for (std::size_t s = 0; s < n_solutions; s++) {
+            expected[guess.id() * n_solutions + s] = Match(guess.word(), all_words[s].word()).value();
+        }
+    }
+
+    // each kernel the CPU has, not only the one picked, over the whole guess x solution table
+    std::vector<uint8_t> values(n_solutions);
+    std::size_t n_mismatches = 0;
+    for (int k = 0; k < Match::kNPackedKernels; k++) {
+        const Match::PackedKernel kernel = static_cast<Match::PackedKernel>(k);
+        if (!Match::has_packed_kernel(kernel)) {
+            std::cout << "Packed match kernel " << Match::packed_kernel_name(kernel) << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        std::size_t n_kernel_mismatches = 0;
+        for (auto &guess : all_words) {
+            Match::packed_values(kernel, packed_words[guess.id()], packed_words.data(), n_solutions, values.data());
+            for (std::size_t s = 0; s < n_solutions; s++) {
+                if (values[s] != expected[guess.id() * n_solutions + s]) n_kernel_mismatches++;
+            }
+        }
+        std::cout << "Packed match kernel " << Match::packed_kernel_name(kernel) << " mismatches: " << n_kernel_mismatches << std::endl;
+        n_mismatches += n_kernel_mismatches;
+    }
+
+    ThreadPool pool;
+    std::ostream quiet(nullptr);
+    MatchTable match_table(pool, word_list, quiet);
+    std::size_t n_endgame_mismatches = check_endgame(match_table, word_list);
+    std::cout << "Endgame mismatches: " << n_endgame_mismatches << std::endl;
+    pool.done();
+
+    std::size_t n_libwordle_failures = check_libwordle();
+    std::cout << "libwordle failures: " << n_libwordle_failures << std::endl;
+    std::cout << "Packed match kernel: " << Match::packed_kernel_name(Match::packed_kernel()) << std::endl;
+    std::cout << "Packed match mismatches: " << n_mismatches << std::endl;
 
     return 0;
 }
@@ -1,27 +1,159 @@
 // Copyright (c) 2022, Bertrand Mollinier Toublet
 // See LICENSE for details of BSD 3-Clause License
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <string>
+#include <utility>
 
 #include "config.h"
 #include "threadpool.h"
 
+namespace {
+
+// the pool, and index in it, of the worker running on this thread
+thread_local ThreadPool *tPool = nullptr;
+thread_local int tWorker = -1;
+// the group of the job running on this thread
+thread_local const TaskGroup *tGroup = nullptr;
+
+// jobs move between free lists this many at a time
+const std::size_t kJobBatch = 64;
+
+// how often a blocked TaskGroup::wait() looks for nested jobs pushed since
+const std::chrono::microseconds kHelpInterval(100);
+
+// hyperthreads share their core's execution units: there is nothing to gain running more workers
+int physical_core_count() {
+    std::set<std::pair<std::string, std::string>> cores;
+    for (unsigned cpu = 0; ; cpu++) {
+        std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        std::ifstream package_ifs(topology + "physical_package_id");
+        std::ifstream core_ifs(topology + "core_id");
+        if (package_ifs.fail() || core_ifs.fail()) break;
+
+        std::string package, core;
+        package_ifs >> package;
+        core_ifs >> core;
+        cores.insert(std::make_pair(package, core));
+    }
+    if (cores.empty()) {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+    return cores.size();
+}
+
+} // namespace anonymous
+
 ThreadPool::ThreadPool()
-    : mAcceptJobs(true)
-    , mNumThreads(2 * std::thread::hardware_concurrency()) {
+    : mJobQueueHead(nullptr)
+    , mJobQueueTail(nullptr)
+    , mFreeJobs(nullptr)
+    , mNFreeJobs(0)
+    , mNumPendingJobs(0)
+    , mNumSleeping(0)
+    , mAcceptJobs(true)
+    , mNumThreads(physical_core_count()) {
 
 #if DEBUG_THREAD_POOL
     std::cout << "Constructing pool with " << mNumThreads << " threads." << std::endl;
 #endif // DEBUG_THREAD_POOL
+    for (int i = 0; i < mNumThreads; i++) {
+        mWorkers.emplace_back(new Worker);
+    }
     for (int i = 0; i < mNumThreads; i++) {
         mPool.push_back(std::thread(&ThreadPool::thread_function, this, i));
     }
 }
 
-void ThreadPool::push(std::function<void()> job) {
-    std::unique_lock<std::mutex> lock(mLock);
-    mJobQueue.push(job);
-    lock.unlock(); // when we send the notification immediately, the consumer will try to get the lock , so unlock asap
-    mCond.notify_one();
+ThreadPool::Job *ThreadPool::allocate_job(int i) {
+    if (i >= 0 && mWorkers[i]->free_jobs) {
+        Worker &worker = *mWorkers[i];
+        Job *job = worker.free_jobs;
+        worker.free_jobs = job->next;
+        worker.n_free_jobs--;
+        return job;
+    }
+
+    std::lock_guard<std::mutex> lock(mFreeJobsLock);
+    if (!mFreeJobs) {
+        mJobBlocks.emplace_back(new Job[kJobBatch]);
+        Job *block = mJobBlocks.back().get();
+        for (std::size_t k = 0; k < kJobBatch; k++) {
+            block[k].next = mFreeJobs;
+            mFreeJobs = &block[k];
+        }
+        mNFreeJobs += kJobBatch;
+    }
+
+    Job *job = mFreeJobs;
+    mFreeJobs = job->next;
+    mNFreeJobs--;
+
+    // a worker takes a whole batch while at it
+    if (i >= 0) {
+        Worker &worker = *mWorkers[i];
+        for (std::size_t k = 1; k < kJobBatch && mFreeJobs; k++) {
+            Job *spare = mFreeJobs;
+            mFreeJobs = spare->next;
+            mNFreeJobs--;
+            spare->next = worker.free_jobs;
+            worker.free_jobs = spare;
+            worker.n_free_jobs++;
+        }
+    }
+    return job;
+}
+
+void ThreadPool::release_job(int i, Job *job) {
+    job->task = Task();
+
+    if (i < 0) {
+        std::lock_guard<std::mutex> lock(mFreeJobsLock);
+        job->next = mFreeJobs;
+        mFreeJobs = job;
+        mNFreeJobs++;
+        return;
+    }
+
+    Worker &worker = *mWorkers[i];
+    job->next = worker.free_jobs;
+    worker.free_jobs = job;
+    worker.n_free_jobs++;
+
+    // jobs pushed on one thread and run on another pile up on the latter: hand a batch back
+    if (worker.n_free_jobs > 2 * kJobBatch) {
+        std::lock_guard<std::mutex> lock(mFreeJobsLock);
+        for (std::size_t k = 0; k < kJobBatch; k++) {
+            Job *spare = worker.free_jobs;
+            worker.free_jobs = spare->next;
+            worker.n_free_jobs--;
+            spare->next = mFreeJobs;
+            mFreeJobs = spare;
+            mNFreeJobs++;
+        }
+    }
+}
+
+void ThreadPool::push(Task task, const TaskGroup *group) {
+    int i = (tPool == this) ? tWorker : -1;
+    Job *job = allocate_job(i);
+    job->task = std::move(task);
+    job->group = group;
+
+    if (i >= 0) {
+        mWorkers[i]->deque.push(job);
+    }
+    else {
+        enqueue(job);
+    }
+
+    mNumPendingJobs.fetch_add(1);
+    if (mNumSleeping.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mLock); } // a worker about to sleep will see the job, or get the notification
+        mCond.notify_one();
+    }
 }
 
 void ThreadPool::done() {
@@ -35,19 +167,169 @@ void ThreadPool::done() {
     }
 }
 
+void ThreadPool::enqueue(Job *job) {
+    std::lock_guard<std::mutex> lock(mQueueLock);
+    job->next = nullptr;
+    if (mJobQueueTail) {
+        mJobQueueTail->next = job;
+    }
+    else {
+        mJobQueueHead = job;
+    }
+    mJobQueueTail = job;
+}
+
+void ThreadPool::run_job(int i, Job *job) {
+    const TaskGroup *outer = tGroup;
+    tGroup = job->group;
+    job->task();
+    tGroup = outer;
+    release_job(i, job);
+}
+
+const TaskGroup *ThreadPool::current_group() {
+    return tGroup;
+}
+
+bool ThreadPool::run_pending_job(const TaskGroup *group) {
+    int i = (tPool == this) ? tWorker : -1;
+    Job *job = next_job(i, group);
+    if (!job) return false;
+
+    run_job(i, job);
+    return true;
+}
+
+bool ThreadPool::run_nested_job(const TaskGroup *group) {
+    int i = (tPool == this) ? tWorker : -1;
+
+    // the oldest job of each other worker: the others beneath it were pushed since, by the same
+    // job, so are nested in it if it is. One that isn't is only looked at once it is taken (its
+    // group may be gone otherwise), then handed to the shared queue for any idle worker.
+    Job *job = nullptr;
+    for (int k = 0; !job && k < mNumThreads; k++) {
+        if (k == i) continue;
+        job = mWorkers[k]->deque.steal();
+        if (job && !group->contains(job->group)) {
+            enqueue(job);
+            job = nullptr;
+        }
+    }
+
+    // jobs in the shared queue are pending, their groups there to be looked at
+    if (!job) {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        Job *previous = nullptr;
+        for (job = mJobQueueHead; job && !group->contains(job->group); job = job->next) {
+            previous = job;
+        }
+        if (job) {
+            (previous ? previous->next : mJobQueueHead) = job->next;
+            if (mJobQueueTail == job) {
+                mJobQueueTail = previous;
+            }
+        }
+    }
+    if (!job) return false;
+
+    mNumPendingJobs.fetch_sub(1);
+    run_job(i, job);
+    return true;
+}
+
+ThreadPool::Job *ThreadPool::next_job(int i) {
+    // own jobs first, most recent first: they are the likeliest to still be in cache
+    Job *job = nullptr;
+    int first = 0;
+    if (i >= 0) {
+        job = mWorkers[i]->deque.pop();
+        first = i + 1;
+    }
+
+    // then the oldest jobs of other workers, which tend to be the largest
+    for (int k = 0; !job && k < mNumThreads; k++) {
+        int victim = (first + k) % mNumThreads;
+        if (victim == i) continue;
+        job = mWorkers[victim]->deque.steal();
+    }
+
+    if (!job) {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        if (mJobQueueHead) {
+            job = mJobQueueHead;
+            mJobQueueHead = job->next;
+            if (!mJobQueueHead) {
+                mJobQueueTail = nullptr;
+            }
+        }
+    }
+
+    if (job) {
+        mNumPendingJobs.fetch_sub(1);
+    }
+    return job;
+}
+
+ThreadPool::Job *ThreadPool::next_job(int i, const TaskGroup *group) {
+    // the group's jobs were pushed by this thread: on top of its own deque, if it is a worker
+    Job *job = nullptr;
+    if (i >= 0) {
+        job = mWorkers[i]->deque.pop();
+        if (job && job->group != group) {
+            mWorkers[i]->deque.push(job);
+            job = nullptr;
+        }
+    }
+    else {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        Job *previous = nullptr;
+        for (job = mJobQueueHead; job && job->group != group; job = job->next) {
+            previous = job;
+        }
+        if (job) {
+            (previous ? previous->next : mJobQueueHead) = job->next;
+            if (mJobQueueTail == job) {
+                mJobQueueTail = previous;
+            }
+        }
+    }
+
+    if (job) {
+        mNumPendingJobs.fetch_sub(1);
+    }
+    return job;
+}
+
 void ThreadPool::thread_function(int i) {
-    std::function<void()> job;
+    tPool = this;
+    tWorker = i;
+
     while (true) {
-        {
-            std::unique_lock<std::mutex> lock(mLock);
-            mCond.wait(lock, [this]() { return !mJobQueue.empty() || !mAcceptJobs; });
-            if (!mAcceptJobs && mJobQueue.empty()) {
-                break;
-            }
-            job = mJobQueue.front();
-            mJobQueue.pop();
+        Job *job = next_job(i);
+        if (job) {
+            run_job(i, job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mNumSleeping.fetch_add(1);
+        mCond.wait(lock, [this]() { return mNumPendingJobs.load() > 0 || !mAcceptJobs; });
+        mNumSleeping.fetch_sub(1);
+        if (!mAcceptJobs && mNumPendingJobs.load() == 0) {
+            break;
         }
-        job();
     }
 }
 
+void TaskGroup::wait() {
+    while (mNumPending.load(std::memory_order_acquire) != 0) {
+        if (mPool.run_pending_job(this) || mPool.run_nested_job(this)) continue;
+
+        // what is left of the group is running elsewhere, with nothing nested to help with yet
+        std::unique_lock<std::mutex> lock(mLock);
+        mCond.wait_for(lock, kHelpInterval, [this]() { return mNumPending.load(std::memory_order_acquire) == 0; });
+    }
+
+    // finish() notifies under the lock: once it is free, no job still uses the group
+    std::lock_guard<std::mutex> lock(mLock);
+}
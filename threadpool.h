@@ -2,26 +2,246 @@
 // See LICENSE for details of BSD 3-Clause License
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// A move-only void() callable stored inline: making, moving and running one never allocates.
+// Captures have to fit in kCapacity bytes (a handful of references or pointers).
+class Task {
+public:
+    static const std::size_t kCapacity = 48;
+
+    Task() : mOps(nullptr) { }
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F &&f) : mOps(&kOps<std::decay_t<F>>) {
+        typedef std::decay_t<F> Callable;
+        static_assert(sizeof(Callable) <= kCapacity, "task captures too large to be stored inline");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "task captures overaligned");
+        new (mStorage) Callable(std::forward<F>(f));
+    }
+
+    Task(Task &&other) : mOps(other.mOps) {
+        if (mOps) {
+            mOps->move(mStorage, other.mStorage);
+            other.reset();
+        }
+    }
+
+    Task &operator=(Task &&other) {
+        if (this != &other) {
+            reset();
+            mOps = other.mOps;
+            if (mOps) {
+                mOps->move(mStorage, other.mStorage);
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() { reset(); }
+
+    inline void operator()() { mOps->invoke(mStorage); }
+    inline explicit operator bool() const { return mOps != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void *);
+        void (*move)(void *, void *);
+        void (*destroy)(void *);
+    };
+
+    template <typename F>
+    static constexpr Ops kOps = {
+        [](void *f) { (*static_cast<F *>(f))(); },
+        [](void *to, void *from) { new (to) F(std::move(*static_cast<F *>(from))); },
+        [](void *f) { static_cast<F *>(f)->~F(); },
+    };
+
+    inline void reset() {
+        if (mOps) {
+            mOps->destroy(mStorage);
+            mOps = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char mStorage[kCapacity];
+    const Ops *mOps;
+};
+
+// Chase-Lev deque: its owner pushes and pops at the bottom, other threads steal from the top
+template <typename T>
+class WorkStealingDeque {
+public:
+    WorkStealingDeque()
+        : mTop(0)
+        , mBottom(0)
+        , mArray(new Array(kInitialCapacity)) {
+        mArrays.emplace_back(mArray.load(std::memory_order_relaxed));
+    }
+
+    // owner only
+    void push(T *item) {
+        int64_t b = mBottom.load(std::memory_order_relaxed);
+        int64_t t = mTop.load(std::memory_order_acquire);
+        Array *a = mArray.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        mBottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // owner only: the most recently pushed item
+    T *pop() {
+        int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+        Array *a = mArray.load(std::memory_order_relaxed);
+        mBottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = mTop.load(std::memory_order_relaxed);
+
+        T *item = nullptr;
+        if (t <= b) {
+            item = a->get(b);
+            if (t == b) {
+                // last item: race the thieves for it
+                if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                mBottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else {
+            mBottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // any thread: the least recently pushed item
+    T *steal() {
+        int64_t t = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = mBottom.load(std::memory_order_acquire);
+
+        if (t < b) {
+            Array *a = mArray.load(std::memory_order_acquire);
+            T *item = a->get(t);
+            if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return item;
+        }
+        return nullptr;
+    }
+
+private:
+    static const int64_t kInitialCapacity = 256;
+
+    struct Array {
+        explicit Array(int64_t c) : capacity(c), items(new std::atomic<T *>[c]) { }
+
+        inline T *get(int64_t i) const { return items[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        inline void put(int64_t i, T *item) { items[i & (capacity - 1)].store(item, std::memory_order_relaxed); }
+
+        const int64_t capacity; // a power of 2
+        std::unique_ptr<std::atomic<T *>[]> items;
+    };
+
+    Array *grow(Array *a, int64_t t, int64_t b) {
+        Array *bigger = new Array(2 * a->capacity);
+        for (int64_t i = t; i < b; i++) {
+            bigger->put(i, a->get(i));
+        }
+        // thieves may still be reading the old array: it is only freed with the deque
+        mArrays.emplace_back(bigger);
+        mArray.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> mTop;
+    alignas(64) std::atomic<int64_t> mBottom;
+    std::atomic<Array *> mArray;
+    std::vector<std::unique_ptr<Array>> mArrays;
+};
+
+class TaskGroup;
+
 class ThreadPool {
 public:
     ThreadPool();
     ThreadPool(bool b) { }
 
-    void push(std::function<void()> job);
+    // group, if any, is the TaskGroup the task is part of
+    void push(Task task, const TaskGroup *group = nullptr);
+    // runs one of the queued jobs of group within reach of this thread; false if there is none
+    bool run_pending_job(const TaskGroup *group);
+    // runs one of the queued jobs of a group nested in group, its own included, wherever it was
+    // pushed; false if there is none
+    bool run_nested_job(const TaskGroup *group);
+    // the group of the job this thread is running, if any
+    static const TaskGroup *current_group();
     void done();
     void thread_function(int);
 
     int num_threads() const { return mNumThreads; }
 
+    // f(i) for every i in [begin, end), handed out grain indices at a time to whichever thread
+    // is free, the caller included
+    template <typename F>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F f);
+
 private:
-    std::queue<std::function<void()>> mJobQueue;
+    // a pushed task, linked in the shared queue or the free lists while not in a deque
+    struct Job {
+        Task task;
+        const TaskGroup *group;
+        Job *next;
+    };
+
+    // what a worker owns: the jobs it pushed, and spare jobs to push more
+    struct Worker {
+        WorkStealingDeque<Job> deque;
+        Job *free_jobs = nullptr;
+        std::size_t n_free_jobs = 0;
+    };
+
+    Job *allocate_job(int i);
+    void release_job(int i, Job *job);
+    void run_job(int i, Job *job);
+    void enqueue(Job *job);
+
+    Job *next_job(int i);
+    Job *next_job(int i, const TaskGroup *group);
+
+    // jobs pushed by a worker go to its own deque; others go through the shared queue
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    Job *mJobQueueHead;
+    Job *mJobQueueTail;
+    std::mutex mQueueLock;
+
+    // jobs are recycled, in batches between the workers' free lists and this one
+    std::vector<std::unique_ptr<Job[]>> mJobBlocks;
+    Job *mFreeJobs;
+    std::size_t mNFreeJobs;
+    std::mutex mFreeJobsLock;
+
+    // idle workers sleep until a job is pushed
+    std::atomic<std::size_t> mNumPendingJobs;
+    std::atomic<int> mNumSleeping;
     std::mutex mLock;
     std::condition_variable mCond;
     bool mAcceptJobs;
@@ -29,3 +249,78 @@ private:
     int mNumThreads;
     std::vector<std::thread> mPool;
 };
+
+// Jobs waited on together. Waiting runs the group's own jobs still queued rather than blocking,
+// so that a worker waiting on the jobs it pushed keeps them moving even when every other worker
+// is busy. Once they are all taken, it helps with those of the groups nested in it (made by its
+// jobs running on other workers, which these are waiting on), blocking only while there are
+// none. No other job is run: whatever the waiter is in the middle of (an outer job, a lock it
+// holds) can't be re-entered.
+//
+// The group's jobs are pushed by the waiting thread, onto its own deque: they must be waited on
+// before that thread pushes any other job, or they may end up beneath it, out of reach.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool)
+        : mPool(pool)
+        , mParent(ThreadPool::current_group())
+        , mNumPending(0) { }
+    ~TaskGroup() { wait(); }
+
+    template <typename F>
+    void run(F &&job) {
+        mNumPending.fetch_add(1);
+        mPool.push([this, job = std::forward<F>(job)]() mutable {
+                job();
+                finish();
+            }, this);
+    }
+    void wait();
+
+    // group is this one, or nested in it; only asked of groups with jobs pending, which keep their
+    // ancestors alive
+    inline bool contains(const TaskGroup *group) const {
+        for (; group; group = group->mParent) {
+            if (group == this) return true;
+        }
+        return false;
+    }
+
+private:
+    // under the lock, so that the waiter can't return (and destroy the group) while notified
+    inline void finish() {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mNumPending.fetch_sub(1, std::memory_order_release) == 1) {
+            mCond.notify_all();
+        }
+    }
+
+    ThreadPool &mPool;
+    const TaskGroup *const mParent; // the group of the job it was made in
+    std::atomic<std::size_t> mNumPending;
+    std::mutex mLock;
+    std::condition_variable mCond;
+};
+
+template <typename F>
+void ThreadPool::parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F f) {
+    if (begin >= end) return;
+
+    std::size_t n_chunks = (end - begin + grain - 1) / grain;
+    std::size_t n_tasks = std::min<std::size_t>(mNumThreads, n_chunks);
+    std::atomic<std::size_t> next(begin);
+    auto task = [&next, end, grain, &f]() {
+        for (std::size_t i = next.fetch_add(grain); i < end; i = next.fetch_add(grain)) {
+            for (std::size_t chunk_end = std::min(i + grain, end); i < chunk_end; i++) {
+                f(i);
+            }
+        }
+    };
+
+    TaskGroup group(*this);
+    for (std::size_t t = 1; t < n_tasks; t++) {
+        group.run([&task]() { task(); });
+    }
+    task();
+    group.wait();
+}
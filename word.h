@@ -6,28 +6,43 @@
 #include <iostream>
 #include <string>
 #include <limits>
+#include <vector>
 #include <cstdint>
 
 class Keyboard;
 
 class Word {
 public:
-    inline Word(std::string word, bool is_solution)
+    static const uint16_t kNoId = std::numeric_limits<uint16_t>::max();
+
+    inline Word(std::string word, bool is_solution, uint16_t id = kNoId)
         : mWord(word)
-        , mIsSolution(is_solution) { }
+        , mIsSolution(is_solution)
+        , mId(id) { }
 
     inline Word(const Word &other)
         : mWord(other.mWord)
-        , mIsSolution(other.mIsSolution) { }
+        , mIsSolution(other.mIsSolution)
+        , mId(other.mId) { }
 
     inline std::string word() const {
         return mWord;
     }
 
+    // for as long as this word lives
+    inline const char *c_str() const {
+        return mWord.c_str();
+    }
+
     inline bool is_solution() const {
         return mIsSolution;
     }
 
+    // index of this word in Wordlist::all_words(); kNoId if not from the word list
+    inline uint16_t id() const {
+        return mId;
+    }
+
     inline void serialize(std::ostream &os) const {
         os.put(mIsSolution);
 
@@ -47,7 +62,7 @@ public:
         size_t word_len = word_len_c;
 
         if (word_len != WORD_LEN) {
-            throw new std::runtime_error("bad string size value");
+            throw std::runtime_error("bad string size value");
         }
 
         char w[word_len];
@@ -65,24 +80,23 @@ public:
 private:
     std::string mWord;
     bool mIsSolution;
+    uint16_t mId;
 };
 
 std::ostream& operator<<(std::ostream& out, const Word& word);
 
 typedef std::vector<Word> Words;
+typedef std::vector<uint16_t> WordIds; // sorted ids into Wordlist::all_words()
 
 class WordEntropy {
 public:
+    // word must outlive the WordEntropy; in practice it is always an entry of Wordlist::all_words()
     inline WordEntropy(const Word &word, uint32_t entropy)
-        : mWord(word)
+        : mWord(&word)
         , mEntropy(entropy) { }
 
-    inline WordEntropy()
-        : mWord("", false)
-        , mEntropy(0) { }
-
     inline const Word &word() const {
-        return mWord;
+        return *mWord;
     }
 
     inline uint32_t entropy() const {
@@ -94,13 +108,15 @@ public:
     }
 
     inline void serialize(std::ostream &os) const {
-        mWord.serialize(os);
+        mWord->serialize(os);
 
         os.write(reinterpret_cast<const char *>(&mEntropy), sizeof mEntropy);
     }
 
-    static inline WordEntropy unserialize(std::istream &is) {
-        Word word = Word::unserialize(is);
+    // canonical maps the unserialized Word onto the word list entry the WordEntropy will point to
+    template <typename Canonical>
+    static inline WordEntropy unserialize(std::istream &is, Canonical canonical) {
+        const Word &word = canonical(Word::unserialize(is));
 
         uint32_t entropy;
         is.read(reinterpret_cast<char *>(&entropy), sizeof entropy);
@@ -108,7 +124,7 @@ public:
         return WordEntropy(word, entropy);
     }
 private:
-    Word mWord;
+    const Word *mWord;
     uint32_t mEntropy;
 };
 
@@ -0,0 +1,257 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#include <cassert>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "gamestate.h"
+#include "keyboard.h"
+#include "match.h"
+#include "matchtable.h"
+#include "state.h"
+#include "statecache.h"
+#include "threadpool.h"
+#include "wordle.h"
+#include "wordlist.h"
+
+namespace {
+
+// The lines written to it, passed to the host's log function as they end; dropped without one.
+class LogBuf : public std::streambuf {
+public:
+    LogBuf(wordle_log_fn log, void *context) : mLog(log), mContext(context) { }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) put(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        for (std::streamsize i = 0; i < n; i++) put(s[i]);
+        return n;
+    }
+
+private:
+    void put(char c) {
+        if (!mLog) return;
+        if (c == '\n') {
+            mLog(mLine.c_str(), mContext);
+            mLine.clear();
+        }
+        else {
+            mLine.push_back(c);
+        }
+    }
+
+    const wordle_log_fn mLog;
+    void *const mContext;
+    std::string mLine;
+};
+
+// its threads joined however the engine goes, failing to construct included
+struct Pool : ThreadPool {
+    ~Pool() { done(); }
+};
+
+} // namespace anonymous
+
+struct wordle_engine {
+    wordle_engine(wordle_log_fn log_fn, void *context)
+        : log_buf(log_fn, context)
+        , log(&log_buf)
+        , state_cache(new StateCache(log))
+        , match_table(pool, word_list, log)
+        , initial_words(new ConsistentWords(word_list))
+        , initial_game_state(init()) { }
+
+    ~wordle_engine() {
+        try {
+            state_cache->persist();
+        }
+        catch (...) { } // nowhere to report it
+        state_cache->wait_for_compaction();
+    }
+
+    LogBuf log_buf;
+    std::ostream log;
+    Pool pool;
+    StateCache::ptr state_cache;
+    Wordlist word_list;
+    MatchTable match_table;
+    Keyboard initial_keyboard;
+    ConsistentWords::ptr initial_words;
+    GameState initial_game_state;
+
+private:
+    GameState init() {
+        State::ptr initial_state(new State(pool, state_cache, word_list, match_table));
+        auto p = state_cache->insert(initial_state);
+        assert(p.second);
+
+        auto c = StateCache::restore(state_cache);
+        assert(c == state_cache);
+
+        return GameState(1, state_cache->initial_state(), initial_keyboard, initial_words);
+    }
+};
+
+struct wordle_session {
+    wordle_session(wordle_engine &engine, int n_boards)
+        : engine(engine)
+        , null(nullptr)
+        , game_states(engine.pool, engine.state_cache, engine.initial_game_state, null) {
+        game_states.switch_game(n_boards);
+    }
+
+    // makes guesses the result
+    const wordle_result *result_of(const std::vector<ScoredEntropy> &best_guesses, std::size_t n_solutions, bool solved) {
+        guesses.clear();
+        for (auto &se : best_guesses) {
+            const Word &word = se.entropy().word();
+            guesses.push_back(wordle_guess{ word.c_str(), word.id(), se.entropy().entropy(), se.score() });
+        }
+        result = wordle_result{ n_solutions, solved, guesses.size(), guesses.data() };
+        return &result;
+    }
+
+    wordle_engine &engine;
+    std::ostream null; // GameStates' displays, unused
+    GameStates game_states;
+
+    std::vector<wordle_guess> guesses;
+    wordle_result result;
+};
+
+// no exception is let through to the C callers: they get an error code, or NULL, instead
+extern "C" {
+
+wordle_engine *wordle_engine_create(wordle_log_fn log, void *context) {
+    try {
+        return new wordle_engine(log, context);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void wordle_engine_destroy(wordle_engine *engine) {
+    delete engine;
+}
+
+int wordle_engine_persist(wordle_engine *engine) {
+    try {
+        engine->state_cache->persist();
+        return WORDLE_OK;
+    }
+    catch (...) {
+        return WORDLE_EFAIL;
+    }
+}
+
+wordle_session *wordle_session_create(wordle_engine *engine, int n_boards) {
+    if (n_boards < 1 || n_boards > GameStates::kMaxNBoards) return nullptr;
+    try {
+        return new wordle_session(*engine, n_boards);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void wordle_session_destroy(wordle_session *session) {
+    delete session;
+}
+
+int wordle_session_n_boards(const wordle_session *session) {
+    return session->game_states.current_game();
+}
+
+int wordle_apply_guess(wordle_session *session, const char *guess, const char *const *matches) {
+    try {
+        GameStates &game_states = session->game_states;
+        if (guess == nullptr || matches == nullptr) return WORDLE_EINVAL;
+        const std::string the_guess(guess);
+        if (the_guess.size() != WORD_LEN) return WORDLE_EINVAL;
+
+        // all or nothing: GameStates::apply_guess() skips the boards whose match is invalid
+        std::vector<std::string> the_matches;
+        for (int i = 0; i < game_states.current_game(); i++) {
+            if (game_states.at(i).state->n_solutions() == 1) {
+                the_matches.push_back(std::string()); // ignored
+                continue;
+            }
+            if (matches[i] == nullptr) return WORDLE_EINVAL;
+            the_matches.push_back(matches[i]);
+
+            bool ok = the_matches.back().size() == WORD_LEN;
+            if (ok) Match::fromString(the_guess, the_matches.back(), ok);
+            if (!ok) return WORDLE_EINVAL;
+        }
+        game_states.apply_guess(the_guess, the_matches);
+        return WORDLE_OK;
+    }
+    catch (...) {
+        return WORDLE_EFAIL;
+    }
+}
+
+int wordle_back_one(wordle_session *session) {
+    return session->game_states.undo() ? WORDLE_OK : WORDLE_EINVAL;
+}
+
+int wordle_reset(wordle_session *session) {
+    try {
+        session->game_states.reset();
+        return WORDLE_OK;
+    }
+    catch (...) {
+        return WORDLE_EFAIL;
+    }
+}
+
+const wordle_result *wordle_best_guess(wordle_session *session, int board) {
+    try {
+        GameStates &game_states = session->game_states;
+        if (board < WORDLE_ALL_BOARDS || board >= game_states.current_game()) return nullptr;
+
+        if (board == WORDLE_ALL_BOARDS) {
+            std::size_t n_solutions = 0;
+            int n_unsolved = 0;
+            for (int i = 0; i < game_states.current_game(); i++) {
+                const GameState &gs = game_states.at(i);
+                if (gs.solved) continue;
+                n_solutions += gs.state->n_solutions();
+                n_unsolved++;
+                board = i;
+            }
+            if (n_unsolved != 1) {
+                return session->result_of(game_states.joint_best_guesses(), n_solutions, n_unsolved == 0);
+            }
+            // just the one board left
+        }
+
+        const GameState &gs = game_states.at(board);
+        return session->result_of(gs.state->best_guess(gs.keyboard), gs.state->n_solutions(), gs.solved);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+uint32_t wordle_entropy_of(wordle_session *session, int board, const char *word) {
+    try {
+        GameStates &game_states = session->game_states;
+        if (board < 0 || board >= game_states.current_game() || word == nullptr) return 0;
+
+        return game_states.at(board).state->entropy_of(word);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+} // extern "C"
@@ -0,0 +1,79 @@
+// Copyright (c) 2022, Bertrand Mollinier Toublet
+// See LICENSE for details of BSD 3-Clause License
+#pragma once
+
+// libwordle: the solver, driven in-process through a C ABI.
+//
+// An engine holds what every game shares: the word list, the match table, the thread pool and the
+// state cache, loaded from and persisted to the working directory (so one engine per process).
+// Sessions play their own games, on one or more boards, and may be used from different threads
+// (each session from one thread at a time).
+//
+// Results are not copied out: they point into a buffer of the session, valid until the next call
+// with that session, and words into the engine's word list, valid as long as the engine.
+//
+// Nothing is written to stdout: the engine's progress (loading, persisting) goes to the log
+// function given, if any.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORDLE_OK      (0)
+#define WORDLE_EINVAL  (-1) // bad board, guess or match
+#define WORDLE_EFAIL   (-2) // the engine failed, as when out of memory
+
+// all the boards at once, for wordle_best_guess()
+#define WORDLE_ALL_BOARDS (-1)
+
+typedef struct wordle_engine wordle_engine;
+typedef struct wordle_session wordle_session;
+
+typedef struct wordle_guess {
+    const char *word;
+    uint16_t id;          // index of word in the word list, solutions first
+    uint32_t entropy;     // in milli-nats; summed over the boards for WORDLE_ALL_BOARDS
+    int32_t score;        // keyboard score, breaking ties between equally good guesses
+} wordle_guess;
+
+typedef struct wordle_result {
+    size_t n_solutions;          // left on the board; summed over the unsolved boards for WORDLE_ALL_BOARDS
+    int solved;                  // the board's solution was guessed
+    size_t n_guesses;
+    const wordle_guess *guesses; // the equally best guesses
+} wordle_result;
+
+// a line of the engine's progress, without its end of line
+typedef void (*wordle_log_fn)(const char *line, void *context);
+
+// log, passed context, may be NULL to stay silent; NULL if the engine couldn't be created
+wordle_engine *wordle_engine_create(wordle_log_fn log, void *context);
+// persists the state cache, then frees the engine; its sessions must be destroyed first
+void wordle_engine_destroy(wordle_engine *engine);
+int wordle_engine_persist(wordle_engine *engine);
+
+// a session of n_boards boards (1 for Wordle, 4 for Quordle...), at the initial state; NULL if
+// n_boards isn't 1 to 32, or the session couldn't be created
+wordle_session *wordle_session_create(wordle_engine *engine, int n_boards);
+void wordle_session_destroy(wordle_session *session);
+int wordle_session_n_boards(const wordle_session *session);
+
+// the matches are one per board, as in "cp_a_", with boards already solved ignored (theirs may be
+// NULL). WORDLE_EINVAL (and nothing applied) if the guess or any other match is invalid or NULL
+int wordle_apply_guess(wordle_session *session, const char *guess, const char *const *matches);
+// back one guess; WORDLE_EINVAL if at the initial state
+int wordle_back_one(wordle_session *session);
+int wordle_reset(wordle_session *session);
+
+// the best guesses on board, or on all the unsolved ones with WORDLE_ALL_BOARDS; NULL if board is
+// invalid, or they couldn't be computed
+const wordle_result *wordle_best_guess(wordle_session *session, int board);
+// the entropy of word on board, in milli-nats; 0 if it isn't an allowed word (or NULL) or the board is invalid
+uint32_t wordle_entropy_of(wordle_session *session, int board, const char *word);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,9 +1,13 @@
 // Copyright (c) 2022, Bertrand Mollinier Toublet
 // See LICENSE for details of BSD 3-Clause License
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
 #include "config.h"
+#include "match.h"
 #include "wordlist.h"
 
-#define N_SOLUTIONS (2315)
 const char * solutions[N_SOLUTIONS] = {
         "cigar", "rebut", "sissy", "humph", "awake", "blush", "focal", "evade", "naval", "serve", "heath", "dwarf", "model",
         "karma", "stink", "grade", "quiet", "bench", "abate", "feign", "major", "death", "fresh", "crust", "stool", "colon",
@@ -1020,18 +1024,100 @@ Words assemble_all_words() {
     Words all_words;
     all_words.reserve(N_SOLUTIONS + N_ALLOWED);
     for (auto w : solutions) {
-        all_words.push_back(Word(w, true));
+        all_words.push_back(Word(w, true, all_words.size()));
     }
     for (auto w : allowed) {
-        all_words.push_back(Word(w, false));
+        all_words.push_back(Word(w, false, all_words.size()));
     }
     return all_words;
 }
 
+std::vector<uint32_t> assemble_packed_words(const Words &all_words) {
+    std::vector<uint32_t> packed_words;
+    packed_words.reserve(all_words.size());
+    for (auto &w : all_words) {
+        packed_words.push_back(Match::pack(w.word()));
+    }
+    return packed_words;
+}
+
+std::vector<uint32_t> assemble_letter_masks(const std::vector<uint32_t> &packed_words) {
+    std::vector<uint32_t> letter_masks;
+    letter_masks.reserve(packed_words.size());
+    for (auto packed : packed_words) {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < WORD_LEN; i++) {
+            mask |= 1u << Match::letter_at(packed, i);
+        }
+        letter_masks.push_back(mask);
+    }
+    return letter_masks;
+}
+
+std::unordered_map<std::string, uint16_t> assemble_index(const Words &all_words) {
+    std::unordered_map<std::string, uint16_t> index;
+    index.reserve(all_words.size());
+    for (auto &w : all_words) {
+        index.emplace(w.word(), w.id());
+    }
+    return index;
+}
+
+uint64_t assemble_signature(const Words &all_words) {
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (auto &w : all_words) {
+        for (char c : w.word()) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 1099511628211ull;
+        }
+        h ^= w.is_solution();
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
 } // namespace anonymous
 
 Wordlist::Wordlist()
-    : mAllWords(assemble_all_words()) {
+    : mAllWords(assemble_all_words())
+    , mNSolutions(std::count_if(mAllWords.begin(), mAllWords.end(), [](const Word &w) { return w.is_solution(); }))
+    , mPackedWords(assemble_packed_words(mAllWords))
+    , mLetterMasks(assemble_letter_masks(mPackedWords))
+    , mIndex(assemble_index(mAllWords))
+    , mSignature(assemble_signature(mAllWords)) {
+    assert(mAllWords.size() < Word::kNoId);
+}
+
+const Word *Wordlist::find(const std::string &word) const {
+    auto it = mIndex.find(word);
+    if (it == mIndex.end()) return nullptr;
+    return &mAllWords.at(it->second);
 }
 
 
+
+WordIds Wordlist::all_word_ids() const {
+    WordIds ids(mAllWords.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    return ids;
+}
+
+WordIds Wordlist::filtered_words_for_guess(const WordIds &words, const std::string &guess, uint32_t match) const {
+    std::vector<uint8_t> values(words.size());
+    const Word *guess_word = find(guess);
+    if (guess_word) {
+        std::vector<uint32_t> packed(words.size());
+        std::transform(words.begin(), words.end(), packed.begin(), [this](uint16_t id) { return mPackedWords[id]; });
+        Match::packed_values(mPackedWords[guess_word->id()], packed.data(), packed.size(), values.data());
+    }
+    else {
+        // not in the word list: no packed representation for it
+        std::transform(words.begin(), words.end(), values.begin(), [this, &guess](uint16_t id) { return Match(guess, mAllWords[id].word()).value(); });
+    }
+
+    WordIds filtered_words;
+    for (std::size_t i = 0; i < words.size(); i++) {
+        if (values[i] == match) filtered_words.push_back(words[i]);
+    }
+    return filtered_words;
+}
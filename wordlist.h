@@ -3,6 +3,7 @@
 #ifndef WORD_LIST_H
 #define WORD_LIST_H
 
+#include <unordered_map>
 #include <vector>
 #include <string>
 
@@ -12,9 +13,28 @@ class Wordlist {
 public:
     Wordlist();
     const Words &all_words() const { return mAllWords; }
+    std::size_t n_solutions() const { return mNSolutions; }
+    // Match::pack() of every word, indexed by word id
+    const std::vector<uint32_t> &packed_words() const { return mPackedWords; }
+    // the letters of every word, as bit (letter - 'a'), indexed by word id
+    const std::vector<uint32_t> &letter_masks() const { return mLetterMasks; }
+
+    // solutions come first in all_words(), so a solution's id is also its solution index
+    const Word *find(const std::string &word) const;
+
+    WordIds all_word_ids() const;
+    // identifies the word list (and its ordering, hence word ids) in files persisted against it
+    uint64_t signature() const { return mSignature; }
+    // the words that would yield match for guess
+    WordIds filtered_words_for_guess(const WordIds &words, const std::string &guess, uint32_t match) const;
 
 private:
     const Words mAllWords;
+    const std::size_t mNSolutions;
+    const std::vector<uint32_t> mPackedWords;
+    const std::vector<uint32_t> mLetterMasks;
+    const std::unordered_map<std::string, uint16_t> mIndex;
+    const uint64_t mSignature;
 };
 
 #endif // WORD_LIST_H